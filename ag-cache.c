@@ -0,0 +1,140 @@
+
+#include "agnostic.h"
+#include "cache.h"
+#include "cache-server.h"
+#include "fsutil.h"
+#include "mirror.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static void print_stats() {
+    struct cache_stats st;
+    cache_read_stats(&st);
+    char* dir = cache_dir();
+    const double mib = 1024.0 * 1024.0;
+    long long lookups = st.hits + st.misses;
+
+    printf(PROP_COLOR "Directory:" TERM_COLOR_RESET " %s\n", dir);
+    printf(PROP_COLOR "Entries:" TERM_COLOR_RESET " %lld\n", st.entries);
+    printf(PROP_COLOR "Size:" TERM_COLOR_RESET " %.1f MiB of %.1f MiB\n", st.size / mib, cache_size_limit() / mib);
+    printf(PROP_COLOR "Hits:" TERM_COLOR_RESET " %lld", st.hits);
+    if (lookups) {
+        printf(" (%.1f%%)", 100.0 * st.hits / lookups);
+    }
+    printf("\n");
+    printf(PROP_COLOR "Misses:" TERM_COLOR_RESET " %lld\n", st.misses);
+    printf(PROP_COLOR "Stores:" TERM_COLOR_RESET " %lld\n", st.stores);
+    printf(PROP_COLOR "Evictions:" TERM_COLOR_RESET " %lld\n", st.evictions);
+    printf(PROP_COLOR "Remote hits:" TERM_COLOR_RESET " %lld\n", st.remote_hits);
+    printf(PROP_COLOR "Uploads:" TERM_COLOR_RESET " %lld\n", st.uploads);
+    free(dir);
+}
+
+static void clear() {
+    char* dir = cache_dir();
+    if (remove_tree(dir)) {
+        perror(dir);
+        die("Failed to clear cache");
+    }
+    free(dir);
+}
+
+// Mirrors, which are not used by any repository, are pruned after this number of days by default.
+#define MIRROR_PRUNE_DAYS 30
+
+static void list_mirrors() {
+    struct mirror_info* mirrors = NULL;
+    int count = mirror_list(&mirrors);
+    const double mib = 1024.0 * 1024.0;
+    for (int i = 0; i < count; ++i) {
+        char used[32];
+        strftime(used, sizeof(used), "%Y-%m-%d", localtime(&mirrors[i].used));
+        printf(PROP_COLOR "%s" TERM_COLOR_RESET " %.1f MiB, used %s, %d repositories\n",
+            mirrors[i].url ? mirrors[i].url : mirrors[i].dir, mirrors[i].size / mib, used, mirrors[i].users);
+    }
+    mirror_list_free(mirrors, count);
+}
+
+static void prune_mirrors(int argc, const char** argv) {
+    int days = MIRROR_PRUNE_DAYS;
+    if (2 == argc && !strcmp("--days", *argv)) {
+        char* end = NULL;
+        long d = strtol(argv[1], &end, 10);
+        if (!*argv[1] || *end || 0 > d || d > 100000) {
+            die("Invalid number of days: %s", argv[1]);
+        }
+        days = (int)d;
+    } else if (argc) {
+        die("Unknown argument: %s", *argv);
+    }
+    printf("Removed %d mirrors\n", mirror_prune(days));
+}
+
+static void serve(int argc, const char** argv) {
+    const char* address = "127.0.0.1";
+    int port = CACHE_SERVER_DEFAULT_PORT;
+    const char* dir = NULL;
+    while (1 <= argc) {
+        if (!strcmp("-p", *argv) || !strcmp("--port", *argv)) {
+            if (2 > argc) {
+                die("Expected port after %s", *argv);
+            }
+            --argc;
+            ++argv;
+            char* end = NULL;
+            long p = strtol(*argv, &end, 10);
+            if (!**argv || *end || 1 > p || p > 65535) {
+                die("Invalid port: %s", *argv);
+            }
+            port = (int)p;
+        } else if (!strcmp("-b", *argv) || !strcmp("--bind", *argv)) {
+            if (2 > argc) {
+                die("Expected address after %s", *argv);
+            }
+            --argc;
+            ++argv;
+            address = *argv;
+        } else if (!dir) {
+            dir = *argv;
+        } else {
+            die("Unknown argument: %s", *argv);
+        }
+        --argc;
+        ++argv;
+    }
+    if (!dir) {
+        die("Expected directory to serve");
+    }
+    char path[PATH_MAX];
+    if (make_dirs(dir, 0755) || !realpath(dir, path)) {
+        perror(dir);
+        die("Unable to create directory to serve");
+    }
+    xexit(cache_serve(path, address, port));
+}
+
+void cache(int argc, const char** argv) {
+    if (1 <= argc && !strcmp("serve", *argv)) {
+        serve(argc - 1, argv + 1);
+    } else if (0 == argc || (1 == argc && !strcmp("stats", *argv))) {
+        print_stats();
+    } else if (1 == argc && !strcmp("prune", *argv)) {
+        printf("Evicted %d entries\n", cache_evict(cache_size_limit()));
+    } else if (1 == argc && !strcmp("clear", *argv)) {
+        clear();
+    } else if (1 == argc && !strcmp("reset-stats", *argv)) {
+        cache_reset_stats();
+    } else if (1 == argc && !strcmp("mirrors", *argv)) {
+        list_mirrors();
+    } else if (1 <= argc && !strcmp("prune-mirrors", *argv)) {
+        prune_mirrors(argc - 1, argv + 1);
+    } else if (1 == argc) {
+        die("Unknown argument: %s", *argv);
+    } else {
+        die("Too many arguments");
+    }
+}
@@ -1,182 +1,303 @@
-
 #include "agnostic.h"
+#include "clone.h"
+#include "selection.h"
+#include "fsutil.h"
 
 #include <sys/wait.h>
-#include <unistd.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <errno.h>
+#include <strings.h>
+#include <unistd.h>
 
 #define START_COLOR TERM_COLOR_CYAN
 #define FINISH_COLOR TERM_COLOR_GREEN
 
-static void checked_symlink(const char* name, const char* alias, int check_exist) {
-    if (empty(alias) || empty(name)) {
-        return;
-    }
-    if (symlink(name, alias)) {
-        if (check_exist || EEXIST != errno) {
-            perror(NULL);
-            fprintf(stderr, "Failed to create alias symlink %s -> %s\n", alias, name);
+#define PROJECT_FILE_NAME "agnostic.yaml"
+
+// Validators of the downloaded project file (see download_project_file()).
+#define DOWNLOAD_META_FILE AG_STATE_DIR "/project-file.meta"
+
+// Default number of concurrent clones for --parallel.
+#define CLONE_PARALLEL_JOBS 8
+
+static pid_t start_clone(struct scheduler* s, struct sched_job* job, int output_fd) {
+    return clone_job_start((struct clone_job*)job->data, output_fd);
+}
+
+static int finish_clone(struct scheduler* s, struct sched_job* job) {
+    return clone_job_finish((struct clone_job*)job->data, job);
+}
+
+// Clones components from the list, which are not cloned yet, running up to 'max_jobs' clones at a time. If
+// 'use_mirror' is 1, Git repositories are cloned via local mirrors. Returns the number of failed clones.
+static int clone_components(struct ag_project* project, struct list* list, int skip_disabled, int max_jobs,
+    int use_mirror) {
+
+    int job_count = 0;
+    struct clone_job* jobs = clone_jobs_create(project, list, skip_disabled, use_mirror, 1 < max_jobs, &job_count);
+    struct scheduler* s = sched_create(job_count, &start_clone, &finish_clone, NULL);
+    for (int i = 0; i < job_count; ++i) {
+        s->jobs[i].name = jobs[i].c->name;
+        s->jobs[i].data = jobs + i;
+        if (-1 != jobs[i].mirror_job) {
+            sched_depend(s, i, jobs[i].mirror_job);
         }
     }
+    s->max_jobs = max_jobs;
+    s->capture = 1 < max_jobs;
+    s->stop_on_failure = 0;
+    int ret = sched_run(s);
+    sched_free(s);
+
+    clone_jobs_free(jobs, job_count);
+    return ret;
 }
 
-static int already_cloned(struct ag_component* c) {
-    if (dir_exists(c->name)) {
-        printf(FINISH_COLOR "Looks like component is already cloned: %s" TERM_COLOR_RESET "\n", c->name);
-        checked_symlink(c->name, c->alias, 0);
-        return 1;
-    } else {
-        return 0;
-    }
+// Validators of the downloaded project file, which are sent with the next download of the same URL, so that the file
+// is only transferred, if it has changed.
+struct download_meta {
+    char* url;
+    char* etag;
+    char* last_modified;
+};
+
+static void free_download_meta(struct download_meta* m) {
+    free(m->url);
+    free(m->etag);
+    free(m->last_modified);
+    memset(m, 0, sizeof(*m));
 }
 
-static char* create_cmdline(struct ag_component* c) {
-    const char* vcs_exe = NULL;
-    if (c->git) {
-        vcs_exe = "git";
-    } else if (c->hg) {
-        vcs_exe = "hg";
-    } else {
-        die("Unknown VCS for %s\n", c->name);
-    }
-    char* vcs = c->git ? c->git : c->hg;
-    char* cmdline = NULL;
-    if (-1 == asprintf(&cmdline, "%s clone \"%s\" \"%s\"", vcs_exe, vcs, c->name)) {
-        die("Couldn't allocate memory for command line");
+// Parses "<key> <value>" lines of the meta file, or "<Key>: <value>" lines of an HTTP response header. In the
+// latter case, only the last response is used, as there may be several of them due to redirects. Returns the HTTP
+// status code, if there's some.
+static int parse_download_meta(const char* text, struct download_meta* m) {
+    int code = 0;
+    char* copy = xstrdup(text ? text : "");
+    char* save = NULL;
+    for (char* line = strtok_r(copy, "\r\n", &save); line; line = strtok_r(NULL, "\r\n", &save)) {
+        if (!strncmp("HTTP/", line, 5)) {
+            free(m->etag);
+            free(m->last_modified);
+            m->etag = NULL;
+            m->last_modified = NULL;
+            const char* sp = strchr(line, ' ');
+            code = sp ? atoi(sp + 1) : 0;
+            continue;
+        }
+        size_t key_len = strcspn(line, ": ");
+        const char* value = line + key_len + strspn(line + key_len, ": \t");
+        if (!*value) {
+            continue;
+        }
+        if (3 == key_len && !strncasecmp("url", line, 3)) {
+            free(m->url);
+            m->url = xstrdup(value);
+        } else if (4 == key_len && !strncasecmp("etag", line, 4)) {
+            free(m->etag);
+            m->etag = xstrdup(value);
+        } else if (13 == key_len && !strncasecmp("last-modified", line, 13)) {
+            free(m->last_modified);
+            m->last_modified = xstrdup(value);
+        }
     }
-    return cmdline;
+    free(copy);
+    return code;
 }
 
-static int run_clone_or_die(struct ag_component* c, const char* cmdline, int supress_output) {
-    printf(START_COLOR "Starting cloning %s" TERM_COLOR_RESET "\n", c->name);
-    int child_pid = run_cmd_line(cmdline, supress_output);
-    if (-1 == child_pid) {
-        perror(NULL);
-        fprintf(stderr, "Failed to run clone for %s\n", c->name);
-        xexit(1);
+static void save_download_meta(const char* url, const struct download_meta* m) {
+    char* content = NULL;
+    if (-1 == asprintf(&content, "url %s\n%s%s%s%s%s%s", url, m->etag ? "etag " : "", m->etag ? m->etag : "",
+            m->etag ? "\n" : "", m->last_modified ? "last-modified " : "", m->last_modified ? m->last_modified : "",
+            m->last_modified ? "\n" : "")) {
+        die("Out of memory, asprintf failed");
+    }
+    if (make_dirs(AG_STATE_DIR, 0755) || write_file_atomic(DOWNLOAD_META_FILE, content)) {
+        fprintf(stderr, WARN_COLOR "Unable to save %s, the next download won't be conditional" COLOR_RESET "\n",
+            DOWNLOAD_META_FILE);
     }
-    return child_pid;
+    free(content);
 }
 
-static int finish_cloning(int status, const char* name, const char* alias, const char* cmdline) {
-    if (WIFEXITED(status)) {
-        if (WEXITSTATUS(status)) {
-            printf("Failed to clone %s. Please, run it manually:\n    %s\n", name, cmdline);
-        } else {
-            printf(FINISH_COLOR "Successfully cloned %s" TERM_COLOR_RESET "\n", name);
-            checked_symlink(name, alias, 1);
-            return 0;
-        }
-    } else {
-        printf("Stopped cloning %s\n", name);
+// Replaces the project file with the new one, unless they're the same. Returns 1, if the file has been replaced.
+static int replace_project_file(const char* tmp_file) {
+    char* old_content = read_file(PROJECT_FILE_NAME);
+    char* new_content = read_file(tmp_file);
+    int same = old_content && new_content && !strcmp(old_content, new_content);
+    free(old_content);
+    free(new_content);
+    if (same) {
+        unlink(tmp_file);
+        return 0;
+    }
+    if (rename(tmp_file, PROJECT_FILE_NAME)) {
+        perror(NULL);
+        unlink(tmp_file);
+        die("Unable to write %s", PROJECT_FILE_NAME);
     }
     return 1;
 }
 
-static void clone_sequential() {
-    struct ag_project* project = ag_load_default_or_die();
-    struct ag_component* c;
-    for (struct list* l = project->components; l; l = l->next) {
-        c = (struct ag_component*)l->data;
+// Downloads the project file over HTTP(S) (or anything else curl supports) into a temp file. Returns 1, if the file
+// has changed.
+static int download_with_curl(const char* url) {
+    struct download_meta old = { 0 };
+    char* meta = path_exists(PROJECT_FILE_NAME) ? read_file(DOWNLOAD_META_FILE) : NULL;
+    parse_download_meta(meta, &old);
+    free(meta);
+    int conditional = old.url && !strcmp(old.url, url);
 
-        if (already_cloned(c)) {
-            continue;
+    char* tmp_file = NULL;
+    char* header_file = NULL;
+    if (-1 == asprintf(&tmp_file, PROJECT_FILE_NAME ".%d.tmp", (int)getpid())
+            || -1 == asprintf(&header_file, PROJECT_FILE_NAME ".%d.headers", (int)getpid())) {
+        die("Out of memory, asprintf failed");
+    }
+    struct buffer cmd = { 0 };
+    const char* args[] = { "curl", "-sS", "-L", "-o", tmp_file, "-D", header_file };
+    for (int i = 0; i < ARRAY_SIZE(args); ++i) {
+        char* arg = shell_quote(args[i]);
+        buffer_append(&cmd, arg, strlen(arg));
+        buffer_append(&cmd, " ", 1);
+        free(arg);
+    }
+    const char* conditions[][2] = {
+        { "If-None-Match: ", conditional ? old.etag : NULL },
+        { "If-Modified-Since: ", conditional ? old.last_modified : NULL }
+    };
+    for (int i = 0; i < ARRAY_SIZE(conditions); ++i) {
+        if (conditions[i][1]) {
+            char* header = NULL;
+            if (-1 == asprintf(&header, "%s%s", conditions[i][0], conditions[i][1])) {
+                die("Out of memory, asprintf failed");
+            }
+            char* arg = shell_quote(header);
+            buffer_append(&cmd, "-H ", 3);
+            buffer_append(&cmd, arg, strlen(arg));
+            buffer_append(&cmd, " ", 1);
+            free(arg);
+            free(header);
         }
-
-        char* cmdline = create_cmdline(c);
-        run_clone_or_die(c, cmdline, 0);
-
-        int status = 0;
-        wait(&status);
-        finish_cloning(status, c->name, c->alias, cmdline);
-
-        free(cmdline);
     }
-    ag_free(project);
-}
+    char* qurl = shell_quote(url);
+    buffer_append(&cmd, qurl, strlen(qurl));
+    free(qurl);
 
-static void clone_parallel() {
-    struct ag_project* project = ag_load_default_or_die();
-    int i = 0;
-    pid_t* pids = (pid_t*)xmalloc(sizeof(pid_t) * project->component_count);
-    char** names = (char**)xmalloc(sizeof(char*) * project->component_count);
-    char** cmdlines = (char**)xmalloc(sizeof(char*) * project->component_count);
-    char** aliases = (char**)xmalloc(sizeof(char*) * project->component_count);
-    struct ag_component* c;
-    for (struct list* l = project->components; l; l = l->next) {
-        c = (struct ag_component*)l->data;
-
-        if (already_cloned(c)) {
-            continue;
+    pid_t pid = run_cmd_line(cmd.data, -1);
+    if (-1 == pid) {
+        perror(NULL);
+        die("Unable to run curl to download %s", url);
+    }
+    int status = 0;
+    while (-1 == waitpid(pid, &status, 0)) {
+        if (EINTR != errno) {
+            perror(NULL);
+            die("Unable to wait for curl to download %s", url);
         }
-
-        char* cmdline = create_cmdline(c);
-        int child_pid = run_clone_or_die(c, cmdline, 1);
-
-        pids[i] = child_pid;
-        names[i] = c->name;
-        cmdlines[i] = cmdline;
-        aliases[i] = c->alias;
-
-        ++i;
     }
+    buffer_free(&cmd);
 
-    int process_size = i;
-    int process_left = process_size;
-    int status = 0;
-    while (0 < process_left) {
-        pid_t pid = wait(&status);
-        --process_left;
-        for (int i = 0; i < process_size; ++i) {
-            if (pids[i] == pid) {
-                finish_cloning(status, names[i], aliases[i], cmdlines[i]);
-                break;
-            }
+    struct download_meta got = { 0 };
+    char* headers = read_file(header_file);
+    int code = parse_download_meta(headers, &got);
+    free(headers);
+    unlink(header_file);
+    free(header_file);
+
+    int changed = 0;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) || (200 != code && 304 != code && 0 != code)) {
+        unlink(tmp_file);
+        if (code) {
+            die("Failed to download %s (HTTP status %d). Please, download it manually, then run 'ag clone'\n", url,
+                code);
         }
+        die("Failed to download %s. Please, download it manually, then run 'ag clone'\n", url);
+    }
+    if (304 == code) {
+        unlink(tmp_file);
+    } else {
+        changed = replace_project_file(tmp_file);
+        save_download_meta(url, &got);
     }
+    free(tmp_file);
+    free_download_meta(&got);
+    free_download_meta(&old);
+    return changed;
+}
 
-    free(pids);
-    free(names);
-    for (int i = 0; i < process_size; ++i) {
-        free(cmdlines[i]);
+// Copies the project file from a local path. Returns 1, if the file has changed.
+static int copy_local_file(const char* path) {
+    char* content = read_file(path);
+    if (!content) {
+        perror(path);
+        die("Failed to read %s\n", path);
     }
-    free(cmdlines);
-    ag_free(project);
+    char* old_content = read_file(PROJECT_FILE_NAME);
+    int changed = !old_content || strcmp(old_content, content);
+    if (changed && write_file_atomic(PROJECT_FILE_NAME, content)) {
+        die("Unable to write %s", PROJECT_FILE_NAME);
+    }
+    free(old_content);
+    free(content);
+    return changed;
 }
 
 static void download_project_file(const char* url) {
     printf(START_COLOR "Downloading project file" TERM_COLOR_RESET "\n");
-    char* cmdline = NULL;
-    asprintf(&cmdline, "curl -sS -o agnostic.yaml \"%s\"", url);
-    run_cmd_line(cmdline, 0);
-    int status = 0;
-    wait(&status);
-    if (WIFEXITED(status)) {
-        if (WEXITSTATUS(status)) {
-            die("Failed to download %s. Please, download it manually, then run 'ag clone'\n", url);
+    fflush(stdout);
+    int changed = 0;
+    if (!strncmp("file://", url, 7)) {
+        // "file:///path" or "file://localhost/path"
+        const char* path = url + 7;
+        if (!strncmp("localhost/", path, 10)) {
+            path += 9;
         }
+        changed = copy_local_file(path);
+    } else if (!strstr(url, "://")) {
+        changed = copy_local_file(url);
     } else {
-        die("Stopped downloading %s\n", url);
+        changed = download_with_curl(url);
+    }
+    if (changed) {
+        printf(FINISH_COLOR "Updated %s" TERM_COLOR_RESET "\n", PROJECT_FILE_NAME);
+    } else {
+        printf(FINISH_COLOR "Project file is up to date" TERM_COLOR_RESET "\n");
     }
-    free(cmdline);
+}
+
+// Returns 1, if the argument is a project file URL rather than a component selection.
+static int is_project_url(const char* arg) {
+    size_t len = strlen(arg);
+    return strstr(arg, "://") || (5 < len && !strcmp(".yaml", arg + len - 5))
+        || (4 < len && !strcmp(".yml", arg + len - 4));
 }
 
 void clone(int argc, const char** argv) {
-    int parallel = 0;
+    int max_jobs = 1;
+    int use_mirror = 0;
     const char* url = NULL;
 
     while (0 < argc) {
         if (!strcmp("-p", *argv) || !strcmp("--parallel", *argv)) {
-            parallel = 1;
+            max_jobs = CLONE_PARALLEL_JOBS;
+        } else if (!strcmp("-j", *argv) || !strcmp("--jobs", *argv)) {
+            if (2 > argc) {
+                die("Expected number of jobs after %s", *argv);
+            }
+            --argc;
+            ++argv;
+            max_jobs = parse_jobs(*argv);
+        } else if (!strcmp("--mirror", *argv)) {
+            use_mirror = 1;
         } else if (0 < strlen(*argv) && '-' == (*argv)[0]) {
             die("Unrecognized option: %s", *argv);
-        } else if (!url) {
+        } else if (!url && is_project_url(*argv)) {
             url = *argv;
         } else {
-            die("Unrecognized argument: %s", *argv);
+            // the rest is the selection of components
+            break;
         }
 
         --argc;
@@ -187,9 +308,19 @@ void clone(int argc, const char** argv) {
         download_project_file(url);
     }
 
-    if (parallel) {
-        clone_parallel();
+    struct ag_project* project = ag_load_default_or_die();
+    int skip_disabled = 0;
+    struct list* list = NULL;
+    if (0 == argc) {
+        // unlike other commands, clone everything by default, as there's no current component yet
+        list = ag_build_all_list(project);
     } else {
-        clone_sequential();
+        list = select_components(project, argc, argv, &skip_disabled);
+    }
+    int failed = clone_components(project, list, skip_disabled, max_jobs, use_mirror);
+    list_free(list, NULL);
+    ag_free(project);
+    if (failed) {
+        xexit(1);
     }
 }
@@ -0,0 +1,302 @@
+// for asprintf()
+#define _GNU_SOURCE
+
+#include "agnostic.h"
+#include "scheduler.h"
+#include "fsutil.h"
+#include "clone.h"
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define START_COLOR TERM_COLOR_CYAN
+#define FINISH_COLOR TERM_COLOR_GREEN
+
+// Limits of a single copy job. Files are copied in batches, so that a process isn't started for each file, while
+// large files still get spread between jobs.
+#define BATCH_FILES 1024
+#define BATCH_BYTES (256LL << 20)
+
+// Prefix of tombstones of 'ag remove', which are never copied.
+#define TOMBSTONE_PREFIX ".ag-removed-"
+
+struct dup_entry {
+    char* src;
+    char* dst;
+    struct stat st;
+    int vcs_object;     // 1, if the file is an immutable VCS object, which may be hardlinked
+};
+
+struct dup_plan {
+    struct dup_entry* files;
+    int file_count;
+    int file_cap;
+    struct dup_entry* dirs;     // in pre-order, so that parents go before children
+    int dir_count;
+    int dir_cap;
+    long long bytes;
+};
+
+struct dup_batch {
+    struct dup_plan* plan;
+    int first;
+    int count;
+};
+
+static void add_entry(struct dup_entry** entries, int* count, int* cap, const char* src, const char* dst,
+    const struct stat* st) {
+
+    if (*count == *cap) {
+        *cap = *cap ? 2 * *cap : 256;
+        *entries = (struct dup_entry*)xrealloc(*entries, *cap * sizeof(struct dup_entry));
+    }
+    struct dup_entry* e = *entries + (*count)++;
+    e->src = xstrdup(src);
+    e->dst = xstrdup(dst);
+    e->st = *st;
+    // Git never modifies objects and packs, and makes them read-only
+    e->vcs_object = NULL != strstr(src, "/.git/objects/") && !(st->st_mode & 0222);
+}
+
+static void set_times(const char* path, const struct stat* st) {
+    struct timespec times[2] = { st->st_atim, st->st_mtim };
+    utimensat(AT_FDCWD, path, times, AT_SYMLINK_NOFOLLOW);
+}
+
+// Creates directories and symlinks of the tree at once, and adds regular files to the plan. Returns 0 on success.
+static int plan_tree(struct dup_plan* plan, const char* src, const char* dst) {
+    struct stat st;
+    if (lstat(src, &st)) {
+        perror(src);
+        return -1;
+    }
+    if (S_ISLNK(st.st_mode) || !(S_ISREG(st.st_mode) || S_ISDIR(st.st_mode))) {
+        // symlinks are cheap, sockets, fifos and devices are not copied
+        if (copy_tree(src, dst, 0)) {
+            perror(dst);
+            return -1;
+        }
+        set_times(dst, &st);
+        return 0;
+    }
+    if (S_ISREG(st.st_mode)) {
+        add_entry(&plan->files, &plan->file_count, &plan->file_cap, src, dst, &st);
+        plan->bytes += st.st_size;
+        return 0;
+    }
+
+    // the directory is made writable, until its contents are copied
+    if (mkdir(dst, (st.st_mode & 07777) | S_IRWXU)) {
+        perror(dst);
+        return -1;
+    }
+    add_entry(&plan->dirs, &plan->dir_count, &plan->dir_cap, src, dst, &st);
+    DIR* dir = opendir(src);
+    if (!dir) {
+        perror(src);
+        return -1;
+    }
+    int ret = 0;
+    struct dirent* e = NULL;
+    while (!ret && (e = readdir(dir))) {
+        if (!strcmp(".", e->d_name) || !strcmp("..", e->d_name)) {
+            continue;
+        }
+        char* s = NULL;
+        char* d = NULL;
+        if (-1 == asprintf(&s, "%s/%s", src, e->d_name) || -1 == asprintf(&d, "%s/%s", dst, e->d_name)) {
+            die("Out of memory, asprintf failed");
+        }
+        ret = plan_tree(plan, s, d);
+        free(s);
+        free(d);
+    }
+    closedir(dir);
+    return ret;
+}
+
+// Returns 1, if the top-level entry of the workspace shouldn't be copied: tombstones, and alias symlinks, which are
+// created anew.
+static int skip_entry(struct ag_project* project, const char* name) {
+    if (!strncmp(TOMBSTONE_PREFIX, name, strlen(TOMBSTONE_PREFIX))) {
+        return 1;
+    }
+    for (struct list* i = project->components; i; i = i->next) {
+        struct ag_component* c = (struct ag_component*)i->data;
+        if (c->alias && !strcmp(c->alias, name)) {
+            char* path = NULL;
+            if (-1 == asprintf(&path, "%s/%s", project->dir, name)) {
+                die("Out of memory, asprintf failed");
+            }
+            struct stat st;
+            int is_link = !lstat(path, &st) && S_ISLNK(st.st_mode);
+            free(path);
+            return is_link;
+        }
+    }
+    return 0;
+}
+
+static pid_t start_batch(struct scheduler* s, struct sched_job* job, int output_fd) {
+    struct dup_batch* b = (struct dup_batch*)job->data;
+    pid_t child_pid = xfork();
+    if (0 == child_pid) {
+        int ret = 0;
+        for (int i = b->first; i < b->first + b->count; ++i) {
+            struct dup_entry* e = b->plan->files + i;
+            if (copy_tree(e->src, e->dst, e->vcs_object ? COPY_HARDLINK_FALLBACK : COPY_REFLINK)) {
+                perror(e->dst);
+                ret = 1;
+            } else {
+                // build tools compare modification times, so they have to stay the same
+                set_times(e->dst, &e->st);
+            }
+        }
+        xexit(ret);
+    }
+    return child_pid;
+}
+
+static int finish_batch(struct scheduler* s, struct sched_job* job) {
+    return !WIFEXITED(job->status) || WEXITSTATUS(job->status);
+}
+
+// Copies regular files of the plan, running up to 'max_jobs' copy jobs at a time. Returns the number of failed jobs.
+static int copy_files(struct dup_plan* plan, int max_jobs) {
+    int count = 0;
+    struct dup_batch* batches = (struct dup_batch*)xcalloc(plan->file_count ? plan->file_count : 1,
+        sizeof(struct dup_batch));
+    for (int i = 0; i < plan->file_count; ) {
+        struct dup_batch* b = batches + count++;
+        b->plan = plan;
+        b->first = i;
+        long long bytes = 0;
+        while (i < plan->file_count && b->count < BATCH_FILES && bytes < BATCH_BYTES) {
+            bytes += plan->files[i++].st.st_size;
+            b->count++;
+        }
+    }
+    struct scheduler* s = sched_create(count, &start_batch, &finish_batch, NULL);
+    for (int i = 0; i < count; ++i) {
+        s->jobs[i].name = plan->files[batches[i].first].src;
+        s->jobs[i].data = batches + i;
+    }
+    s->max_jobs = max_jobs;
+    int failed = sched_run(s);
+    sched_free(s);
+    free(batches);
+    return failed;
+}
+
+static void free_entries(struct dup_entry* entries, int count) {
+    for (int i = 0; i < count; ++i) {
+        free(entries[i].src);
+        free(entries[i].dst);
+    }
+    free(entries);
+}
+
+void duplicate(int argc, const char** argv) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_jobs = 1 < ncpu ? ncpu : 1;
+    const char* dest = NULL;
+
+    while (1 <= argc) {
+        if (!strcmp("-j", *argv) || !strcmp("--jobs", *argv)) {
+            if (2 > argc) {
+                die("Expected number of jobs after %s", *argv);
+            }
+            --argc;
+            ++argv;
+            max_jobs = parse_jobs(*argv);
+        } else if (0 < strlen(*argv) && '-' == (*argv)[0]) {
+            die("Unrecognized option: %s", *argv);
+        } else if (!dest) {
+            dest = *argv;
+        } else {
+            die("Unknown argument: %s", *argv);
+        }
+        --argc;
+        ++argv;
+    }
+    if (!dest) {
+        die("Expected destination directory");
+    }
+
+    struct ag_project* project = ag_load_default_or_die();
+    struct stat st;
+    if (stat(project->dir, &st)) {
+        die("Unable to read workspace %s", project->dir);
+    }
+    if (mkdir(dest, (st.st_mode & 07777) | S_IRWXU)) {
+        perror(dest);
+        die("Unable to create %s, it must not exist", dest);
+    }
+    char* real_dest = realpath(dest, NULL);
+    size_t dir_len = strlen(project->dir);
+    if (!real_dest || (!strncmp(project->dir, real_dest, dir_len) && '/' == real_dest[dir_len])) {
+        rmdir(dest);
+        die("Destination must be outside of the workspace: %s", dest);
+    }
+    free(real_dest);
+
+    printf(START_COLOR "Scanning %s" TERM_COLOR_RESET "\n", project->dir);
+    fflush(stdout);
+    struct dup_plan plan = { 0 };
+    int failed = 0;
+    DIR* dir = opendir(project->dir);
+    struct dirent* e = NULL;
+    while (!failed && dir && (e = readdir(dir))) {
+        if (!strcmp(".", e->d_name) || !strcmp("..", e->d_name) || skip_entry(project, e->d_name)) {
+            continue;
+        }
+        char* s = NULL;
+        char* d = NULL;
+        if (-1 == asprintf(&s, "%s/%s", project->dir, e->d_name) || -1 == asprintf(&d, "%s/%s", dest, e->d_name)) {
+            die("Out of memory, asprintf failed");
+        }
+        failed = plan_tree(&plan, s, d);
+        free(s);
+        free(d);
+    }
+    if (dir) {
+        closedir(dir);
+    }
+
+    if (!failed) {
+        printf(START_COLOR "Copying %d files (%lld MiB)" TERM_COLOR_RESET "\n", plan.file_count, plan.bytes >> 20);
+        fflush(stdout);
+        failed = copy_files(&plan, max_jobs);
+    }
+    // children first, so that their creation doesn't change times of the parents
+    for (int i = plan.dir_count - 1; 0 <= i; --i) {
+        chmod(plan.dirs[i].dst, plan.dirs[i].st.st_mode & 07777);
+        set_times(plan.dirs[i].dst, &plan.dirs[i].st);
+    }
+    for (struct list* i = project->components; !failed && i; i = i->next) {
+        struct ag_component* c = (struct ag_component*)i->data;
+        char* component_dir = NULL;
+        if (-1 == asprintf(&component_dir, "%s/%s", dest, c->name)) {
+            die("Out of memory, asprintf failed");
+        }
+        if (dir_exists(component_dir)) {
+            clone_link_alias(dest, c);
+        }
+        free(component_dir);
+    }
+
+    free_entries(plan.files, plan.file_count);
+    free_entries(plan.dirs, plan.dir_count);
+    ag_free(project);
+    if (failed) {
+        die("Failed to duplicate the workspace, %s is incomplete", dest);
+    }
+    printf(FINISH_COLOR "Duplicated the workspace to %s" COLOR_RESET "\n", dest);
+}
@@ -0,0 +1,225 @@
+// for asprintf()
+#define _GNU_SOURCE
+
+#include "agnostic.h"
+#include "scheduler.h"
+#include "selection.h"
+
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define START_COLOR TERM_COLOR_CYAN
+
+struct exec_job {
+    struct ag_component* c;
+    char* cmdline;
+    int done;
+    int finished;           // 0, if the command hasn't been run due to a failure
+    int status;             // exit status of the command, as returned by wait()
+    struct buffer output;   // captured output, if output is grouped
+};
+
+struct exec_run {
+    struct exec_job* jobs;
+    int count;
+    int next;       // index of the first job, which output hasn't been printed yet
+    int grouped;    // if 1, output is captured and printed per component in the selection order
+};
+
+// Returns the command line, which runs the command in the directory of the component. A single argument is a shell
+// command, several arguments are a command with its arguments, which are passed as is.
+static char* exec_cmdline(struct ag_project* project, struct ag_component* c, int argc, const char** argv) {
+    struct buffer b = { 0 };
+    char* dir = ag_component_dir(project, c);
+    char* qdir = shell_quote(dir);
+    char* qname = shell_quote(c->name);
+    char* header = NULL;
+    if (-1 == asprintf(&header, "cd %s || exit\nAG_COMPONENT=%s\nexport AG_COMPONENT\n", qdir, qname)) {
+        die("Out of memory, asprintf failed");
+    }
+    buffer_append(&b, header, strlen(header));
+    free(header);
+    free(qname);
+    free(qdir);
+    free(dir);
+    if (1 == argc) {
+        buffer_append(&b, *argv, strlen(*argv));
+    } else {
+        for (int i = 0; i < argc; ++i) {
+            char* arg = shell_quote(argv[i]);
+            buffer_append(&b, i ? " " : "exec ", i ? 1 : 5);
+            buffer_append(&b, arg, strlen(arg));
+            free(arg);
+        }
+    }
+    buffer_append(&b, "\n", 1);
+    return b.data;
+}
+
+static void print_result(struct exec_job* j) {
+    if (j->output.len) {
+        fwrite(j->output.data, 1, j->output.len, stdout);
+        if ('\n' != j->output.data[j->output.len - 1]) {
+            putchar('\n');
+        }
+    }
+    if (!j->finished) {
+        printf(WARN_COLOR "Not run due to a failure: %s" COLOR_RESET "\n", j->c->name);
+    } else if (!WIFEXITED(j->status)) {
+        printf(WARN_COLOR "Killed by signal %d: %s" COLOR_RESET "\n", WTERMSIG(j->status), j->c->name);
+    } else if (WEXITSTATUS(j->status)) {
+        printf(WARN_COLOR "Exit status %d: %s" COLOR_RESET "\n", WEXITSTATUS(j->status), j->c->name);
+    }
+}
+
+// Prints output of completed jobs, which go before all pending ones, so that output order doesn't depend on timing.
+static void print_completed(struct exec_run* r) {
+    while (r->next < r->count && r->jobs[r->next].done) {
+        struct exec_job* j = r->jobs + r->next;
+        printf(START_COLOR "%s" TERM_COLOR_RESET "\n", j->c->name);
+        print_result(j);
+        buffer_free(&j->output);
+        r->next++;
+    }
+    fflush(stdout);
+}
+
+static pid_t start_exec(struct scheduler* s, struct sched_job* job, int output_fd) {
+    struct exec_run* r = (struct exec_run*)s->ctx;
+    struct exec_job* j = (struct exec_job*)job->data;
+    if (!r->grouped) {
+        printf(START_COLOR "%s" TERM_COLOR_RESET "\n", j->c->name);
+        fflush(stdout);
+    }
+    pid_t child_pid = run_cmd_line(j->cmdline, output_fd);
+    if (-1 == child_pid) {
+        perror(NULL);
+        fprintf(stderr, "Failed to run command for %s\n", j->c->name);
+    }
+    return child_pid;
+}
+
+static int finish_exec(struct scheduler* s, struct sched_job* job) {
+    struct exec_run* r = (struct exec_run*)s->ctx;
+    struct exec_job* j = (struct exec_job*)job->data;
+    j->done = 1;
+    j->finished = 1;
+    j->status = job->status;
+    if (r->grouped) {
+        // the scheduler frees the output, when the job is completed
+        j->output = job->output;
+        memset(&job->output, 0, sizeof(job->output));
+        print_completed(r);
+    } else {
+        print_result(j);
+    }
+    return !WIFEXITED(job->status) || WEXITSTATUS(job->status);
+}
+
+void execute(int argc, const char** argv) {
+    int max_jobs = 1;
+    int ordered = 0;
+
+    while (1 <= argc) {
+        if (!strcmp("-j", *argv) || !strcmp("--jobs", *argv)) {
+            if (2 > argc) {
+                die("Expected number of jobs after %s", *argv);
+            }
+            --argc;
+            ++argv;
+            max_jobs = parse_jobs(*argv);
+        } else if (!strcmp("-o", *argv) || !strcmp("--ordered", *argv)) {
+            ordered = 1;
+        } else if (!strcmp("--", *argv)) {
+            break;
+        } else if (0 < strlen(*argv) && '-' == (*argv)[0]) {
+            die("Unrecognized option: %s", *argv);
+        } else {
+            break;
+        }
+        --argc;
+        ++argv;
+    }
+
+    // the selection goes up to "--", the command goes after it
+    int selection_argc = 0;
+    while (selection_argc < argc && strcmp("--", argv[selection_argc])) {
+        ++selection_argc;
+    }
+    if (selection_argc + 1 >= argc) {
+        die("Expected command after --");
+    }
+    int cmd_argc = argc - selection_argc - 1;
+    const char** cmd_argv = argv + selection_argc + 1;
+
+    struct ag_project* project = ag_load_default_or_die();
+    int skip_disabled = 0;
+    struct list* list = NULL;
+    if (0 == selection_argc) {
+        // all components by default, as loops over the workspace are what this replaces
+        list = ag_build_all_list(project);
+    } else {
+        list = select_components(project, selection_argc, argv, &skip_disabled);
+    }
+
+    int count = 0;
+    for (struct list* i = list; i; i = i->next) {
+        ++count;
+    }
+    struct exec_job* jobs = (struct exec_job*)xcalloc(count ? count : 1, sizeof(struct exec_job));
+    int n = 0;
+    for (struct list* i = list; i; i = i->next) {
+        struct ag_component* c = (struct ag_component*)i->data;
+        char* dir = ag_component_dir(project, c);
+        if (!(skip_disabled && c->disabled) && dir_exists(dir)) {
+            jobs[n].c = c;
+            jobs[n++].cmdline = exec_cmdline(project, c, cmd_argc, cmd_argv);
+        }
+        free(dir);
+    }
+
+    struct exec_run r = { jobs, n, 0, 1 < max_jobs };
+    struct scheduler* s = sched_create(n, &start_exec, &finish_exec, &r);
+    for (int i = 0; i < n; ++i) {
+        s->jobs[i].name = jobs[i].c->name;
+        s->jobs[i].data = jobs + i;
+        // the list is ordered by dependencies, so only earlier jobs may need to be waited for
+        for (struct list* b = ordered ? jobs[i].c->build_after : NULL; b; b = b->next) {
+            struct ag_component* dep = ag_find_component(project, (char*)b->data);
+            for (int k = 0; k < i; ++k) {
+                if (dep == jobs[k].c) {
+                    sched_depend(s, i, k);
+                }
+            }
+        }
+    }
+    s->max_jobs = max_jobs;
+    s->capture = r.grouped;
+    s->stop_on_failure = ordered;
+    int failed = sched_run(s);
+
+    // jobs cancelled after a failure are never finished
+    for (int i = 0; i < n; ++i) {
+        if (!jobs[i].done && !r.grouped) {
+            print_result(jobs + i);
+        }
+        jobs[i].done = 1;
+    }
+    if (r.grouped) {
+        print_completed(&r);
+    }
+
+    sched_free(s);
+    for (int i = 0; i < n; ++i) {
+        free(jobs[i].cmdline);
+    }
+    free(jobs);
+    list_free(list, NULL);
+    ag_free(project);
+    if (failed) {
+        xexit(1);
+    }
+}
@@ -0,0 +1,239 @@
+// for asprintf()
+#define _GNU_SOURCE
+
+#include "agnostic.h"
+#include "scheduler.h"
+#include "selection.h"
+
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define START_COLOR TERM_COLOR_CYAN
+#define FINISH_COLOR TERM_COLOR_GREEN
+
+// Default number of concurrent updates.
+#define PULL_DEFAULT_JOBS 8
+
+// Exit codes of the update script, which aren't failures.
+#define PULL_DIRTY 3        // the working tree has local changes, so it's left alone
+#define PULL_NO_UPSTREAM 4  // fetched, but there's no upstream branch to fast-forward to
+
+// Prefix of the line, which the update script prints on success: "<prefix> <old revision> <new revision>".
+#define PULL_MARKER "ag-pull:"
+
+enum pull_result {
+    PULL_NOT_RUN,
+    PULL_FAILED,
+    PULL_MOVED,
+    PULL_UP_TO_DATE,
+    PULL_SKIPPED
+};
+
+struct pull_job {
+    struct ag_component* c;
+    char* cmdline;
+    enum pull_result result;
+};
+
+// Returns the command line, which updates the repository in the given directory, or NULL, if the component has no
+// repository. Local changes are checked first, so the working tree is never touched, if it has any. Untracked files
+// don't count, as fast-forward refuses to overwrite them anyway.
+static char* update_cmdline(struct ag_component* c, const char* dir, int no_prompt) {
+    struct buffer b = { 0 };
+    char* qdir = shell_quote(dir);
+    buffer_append(&b, "cd ", 3);
+    buffer_append(&b, qdir, strlen(qdir));
+    buffer_append(&b, " || exit\n", 9);
+    free(qdir);
+
+    char* script = NULL;
+    int rc = 0;
+    if (c->git) {
+        rc = asprintf(&script,
+            "test -z \"$(git status --porcelain --untracked-files=no)\" || exit %d\n"
+            "old=$(git rev-parse HEAD) || exit\n"
+            "%sgit fetch --prune || exit\n"
+            "git rev-parse -q --verify '@{u}' >/dev/null || exit %d\n"
+            "git merge --ff-only '@{u}' || exit\n"
+            "echo \"" PULL_MARKER " $old $(git rev-parse HEAD)\"\n",
+            PULL_DIRTY, no_prompt ? "GIT_TERMINAL_PROMPT=0 " : "", PULL_NO_UPSTREAM);
+    } else if (c->hg) {
+        rc = asprintf(&script,
+            "test -z \"$(hg status -mard)\" || exit %d\n"
+            "old=$(hg id -i) || exit\n"
+            "hg pull -u || exit\n"
+            "echo \"" PULL_MARKER " $old $(hg id -i)\"\n",
+            PULL_DIRTY);
+    } else {
+        buffer_free(&b);
+        return NULL;
+    }
+    if (-1 == rc) {
+        die("Out of memory, asprintf failed");
+    }
+    buffer_append(&b, script, strlen(script));
+    free(script);
+    return b.data;
+}
+
+// Creates jobs for components from the list, which are cloned. Components, which resolve to the same directory, get
+// one job. Sets 'job_count' and 'not_cloned'.
+static struct pull_job* create_jobs(struct ag_project* project, struct list* list, int skip_disabled, int no_prompt,
+    int* job_count, int* not_cloned) {
+
+    int count = 0;
+    for (struct list* i = list; i; i = i->next) {
+        ++count;
+    }
+    struct pull_job* jobs = (struct pull_job*)xcalloc(count ? count : 1, sizeof(struct pull_job));
+    char** dirs = (char**)xcalloc(count ? count : 1, sizeof(char*));
+    int n = 0;
+    *not_cloned = 0;
+    for (struct list* i = list; i; i = i->next) {
+        struct ag_component* c = (struct ag_component*)i->data;
+        if (skip_disabled && c->disabled) {
+            continue;
+        }
+        char* dir = ag_component_dir(project, c);
+        char* real = realpath(dir, NULL);
+        free(dir);
+        if (!real || !dir_exists(real)) {
+            ++*not_cloned;
+            free(real);
+            continue;
+        }
+        int seen = 0;
+        for (int k = 0; k < n && !seen; ++k) {
+            seen = !strcmp(dirs[k], real);
+        }
+        char* cmdline = seen ? NULL : update_cmdline(c, real, no_prompt);
+        if (cmdline) {
+            jobs[n].c = c;
+            jobs[n].cmdline = cmdline;
+            dirs[n++] = real;
+        } else {
+            free(real);
+        }
+    }
+    for (int k = 0; k < n; ++k) {
+        free(dirs[k]);
+    }
+    free(dirs);
+    *job_count = n;
+    return jobs;
+}
+
+static pid_t start_update(struct scheduler* s, struct sched_job* job, int output_fd) {
+    struct pull_job* j = (struct pull_job*)job->data;
+    printf(START_COLOR "Updating %s" TERM_COLOR_RESET "\n", j->c->name);
+    fflush(stdout);
+    pid_t child_pid = run_cmd_line(j->cmdline, output_fd);
+    if (-1 == child_pid) {
+        perror(NULL);
+        fprintf(stderr, "Failed to run update for %s\n", j->c->name);
+    }
+    return child_pid;
+}
+
+static int finish_update(struct scheduler* s, struct sched_job* job) {
+    struct pull_job* j = (struct pull_job*)job->data;
+    int code = WIFEXITED(job->status) ? WEXITSTATUS(job->status) : -1;
+    if (PULL_DIRTY == code) {
+        printf(WARN_COLOR "Local changes, skipping: %s" COLOR_RESET "\n", j->c->name);
+        j->result = PULL_SKIPPED;
+        return 0;
+    }
+    if (PULL_NO_UPSTREAM == code) {
+        printf(WARN_COLOR "Fetched, but no upstream branch to fast-forward to: %s" COLOR_RESET "\n", j->c->name);
+        j->result = PULL_SKIPPED;
+        return 0;
+    }
+    char* marker = (0 == code && job->output.data) ? strstr(job->output.data, PULL_MARKER " ") : NULL;
+    char old_rev[41] = "";
+    char new_rev[41] = "";
+    if (!marker || 2 != sscanf(marker + strlen(PULL_MARKER), " %40s %40s", old_rev, new_rev)) {
+        if (job->output.len) {
+            printf(PROP_COLOR "Output of %s:" COLOR_RESET "\n", j->c->name);
+            fwrite(job->output.data, 1, job->output.len, stdout);
+        }
+        fprintf(stderr, "Failed to update %s\n", j->c->name);
+        j->result = PULL_FAILED;
+        return 1;
+    }
+    if (!strcmp(old_rev, new_rev)) {
+        printf(FINISH_COLOR "Up to date: %s" TERM_COLOR_RESET "\n", j->c->name);
+        j->result = PULL_UP_TO_DATE;
+    } else {
+        printf(FINISH_COLOR "Updated %s: %.12s..%.12s" TERM_COLOR_RESET "\n", j->c->name, old_rev, new_rev);
+        j->result = PULL_MOVED;
+    }
+    return 0;
+}
+
+void pull(int argc, const char** argv) {
+    int max_jobs = PULL_DEFAULT_JOBS;
+
+    while (1 <= argc) {
+        if (!strcmp("-j", *argv) || !strcmp("--jobs", *argv)) {
+            if (2 > argc) {
+                die("Expected number of jobs after %s", *argv);
+            }
+            --argc;
+            ++argv;
+            max_jobs = parse_jobs(*argv);
+        } else if (0 < strlen(*argv) && '-' == (*argv)[0]) {
+            die("Unrecognized option: %s", *argv);
+        } else {
+            break;
+        }
+        --argc;
+        ++argv;
+    }
+
+    struct ag_project* project = ag_load_default_or_die();
+    int skip_disabled = 0;
+    struct list* list = NULL;
+    if (0 == argc) {
+        // like clone, update everything, which is cloned, by default
+        list = ag_build_all_list(project);
+    } else {
+        list = select_components(project, argc, argv, &skip_disabled);
+    }
+
+    int job_count = 0;
+    int not_cloned = 0;
+    struct pull_job* jobs = create_jobs(project, list, skip_disabled, 1 < max_jobs, &job_count, &not_cloned);
+    struct scheduler* s = sched_create(job_count, &start_update, &finish_update, NULL);
+    for (int i = 0; i < job_count; ++i) {
+        s->jobs[i].name = jobs[i].c->name;
+        s->jobs[i].data = jobs + i;
+    }
+    s->max_jobs = max_jobs;
+    // repositories are independent, so a broken remote doesn't stop updates of the others
+    s->stop_on_failure = 0;
+    // output is always captured, as it's needed to tell, whether the repository has moved
+    s->capture = 1;
+    int failed = sched_run(s);
+
+    int counts[PULL_SKIPPED + 1] = { 0 };
+    for (int i = 0; i < job_count; ++i) {
+        counts[jobs[i].result]++;
+    }
+    printf(PROP_COLOR "Updated: " COLOR_RESET "%d, " PROP_COLOR "up to date: " COLOR_RESET "%d, "
+        PROP_COLOR "skipped: " COLOR_RESET "%d, " PROP_COLOR "failed: " COLOR_RESET "%d, "
+        PROP_COLOR "not cloned: " COLOR_RESET "%d\n",
+        counts[PULL_MOVED], counts[PULL_UP_TO_DATE], counts[PULL_SKIPPED], counts[PULL_FAILED], not_cloned);
+
+    sched_free(s);
+    for (int i = 0; i < job_count; ++i) {
+        free(jobs[i].cmdline);
+    }
+    free(jobs);
+    list_free(list, NULL);
+    ag_free(project);
+    if (failed) {
+        xexit(1);
+    }
+}
@@ -0,0 +1,73 @@
+#include "agnostic.h"
+#include "query.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Prints the result of the query, one component name per line. Returns 0 on success.
+static int run_query(struct query_graph* g, const char* query, int batch) {
+    struct list* result = NULL;
+    char* error = NULL;
+    if (query_eval(g, query, &result, &error)) {
+        if (batch) {
+            // errors go to the same stream, so that answers stay in sync with queries
+            printf("error: %s\n", error);
+        } else {
+            fprintf(stderr, "Invalid query: %s\n", error);
+        }
+        free(error);
+        return -1;
+    }
+    for (struct list* i = result; i; i = i->next) {
+        printf("%s\n", ((struct ag_component*)i->data)->name);
+    }
+    list_free(result, NULL);
+    return 0;
+}
+
+void query(int argc, const char** argv) {
+    int batch = 0;
+    if (1 <= argc && !strcmp("--batch", *argv)) {
+        batch = 1;
+        --argc;
+        ++argv;
+    }
+    if (batch == (0 < argc)) {
+        die(batch ? "Queries are read from standard input in batch mode" : "Expected query");
+    }
+
+    struct ag_project* project = ag_load_default_or_die();
+    struct query_graph* g = query_graph_create(project);
+    int failed = 0;
+    if (batch) {
+        // each line is a query, each answer ends with an empty line
+        char* line = NULL;
+        size_t cap = 0;
+        ssize_t len = 0;
+        while (0 < (len = getline(&line, &cap, stdin))) {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (!line[strspn(line, " \t")] || '#' == line[strspn(line, " \t")]) {
+                continue;
+            }
+            failed |= run_query(g, line, 1);
+            printf("\n");
+            fflush(stdout);
+        }
+        free(line);
+    } else {
+        // arguments are joined, so that the query may be passed unquoted, if the shell allows
+        struct buffer text = { 0 };
+        for (int i = 0; i < argc; ++i) {
+            buffer_append(&text, i ? " " : "", i ? 1 : 0);
+            buffer_append(&text, argv[i], strlen(argv[i]));
+        }
+        failed = run_query(g, text.data, 0);
+        buffer_free(&text);
+    }
+    query_graph_free(g);
+    ag_free(project);
+    if (failed) {
+        xexit(1);
+    }
+}
@@ -0,0 +1,237 @@
+// for asprintf()
+#define _GNU_SOURCE
+
+#include "agnostic.h"
+#include "scheduler.h"
+#include "fsutil.h"
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define START_COLOR TERM_COLOR_CYAN
+#define FINISH_COLOR TERM_COLOR_GREEN
+
+// Prefix of the names of component directories, which are being removed. Such directories are left in the project
+// directory, if removal has been interrupted, and are removed by the next 'ag remove'.
+#define TOMBSTONE_PREFIX ".ag-removed-"
+
+// Returns 1, if the user confirms removal.
+static int confirm() {
+    printf("This will remove all project directories. Are you sure? [y/N] ");
+    fflush(stdout);
+    char answer[16];
+    return fgets(answer, sizeof(answer), stdin) && ('y' == answer[0] || 'Y' == answer[0]);
+}
+
+// Removes the alias symlink of the component, if it points to the component directory. Anything else is left alone.
+static void remove_alias(struct ag_project* project, struct ag_component* c) {
+    if (!c->alias) {
+        return;
+    }
+    char* alias = NULL;
+    if (-1 == asprintf(&alias, "%s/%s", project->dir, c->alias)) {
+        die("Out of memory, asprintf failed");
+    }
+    char target[PATH_MAX];
+    ssize_t len = readlink(alias, target, sizeof(target) - 1);
+    if (0 <= len) {
+        target[len] = '\0';
+        if (!strcmp(target, c->name) && unlink(alias)) {
+            perror(NULL);
+            fprintf(stderr, "Failed to remove alias symlink %s\n", alias);
+        }
+    } else if (EINVAL == errno) {
+        fprintf(stderr, WARN_COLOR "Not a symlink, leaving it: %s" COLOR_RESET "\n", alias);
+    }
+    free(alias);
+}
+
+// Renames component directories to tombstones, so that they are gone from the workspace at once. Returns 0 on
+// success.
+static int bury_components(struct ag_project* project) {
+    int ret = 0;
+    for (struct list* i = project->components; i; i = i->next) {
+        struct ag_component* c = (struct ag_component*)i->data;
+        remove_alias(project, c);
+        char* dir = ag_component_dir(project, c);
+        char* tombstone = NULL;
+        if (-1 == asprintf(&tombstone, "%s/" TOMBSTONE_PREFIX "%s-%d", project->dir, c->name, (int)getpid())) {
+            die("Out of memory, asprintf failed");
+        }
+        struct stat st;
+        if (!lstat(dir, &st) && !S_ISDIR(st.st_mode)) {
+            fprintf(stderr, WARN_COLOR "Not a directory, leaving it: %s" COLOR_RESET "\n", dir);
+        } else if (rename(dir, tombstone) && ENOENT != errno) {
+            perror(NULL);
+            fprintf(stderr, "Failed to remove %s\n", dir);
+            ret = -1;
+        }
+        free(tombstone);
+        free(dir);
+    }
+    return ret;
+}
+
+// Returns the list of entries of all tombstones in the project directory, and sets 'tombstones' to the list of the
+// tombstones themselves. Entries are removed in parallel, so that a single large tree doesn't take a single walker.
+static struct list* list_tombstones(struct ag_project* project, struct list** tombstones) {
+    struct list* head = NULL;
+    struct list* tail = NULL;
+    struct list* dirs_tail = NULL;
+    *tombstones = NULL;
+    DIR* dir = opendir(project->dir);
+    struct dirent* e = NULL;
+    while (dir && (e = readdir(dir))) {
+        if (strncmp(TOMBSTONE_PREFIX, e->d_name, strlen(TOMBSTONE_PREFIX))) {
+            continue;
+        }
+        char* tombstone = NULL;
+        if (-1 == asprintf(&tombstone, "%s/%s", project->dir, e->d_name)) {
+            die("Out of memory, asprintf failed");
+        }
+        list_add(tombstones, &dirs_tail, tombstone);
+        DIR* sub = opendir(tombstone);
+        struct dirent* s = NULL;
+        while (sub && (s = readdir(sub))) {
+            if (strcmp(".", s->d_name) && strcmp("..", s->d_name)) {
+                char* path = NULL;
+                if (-1 == asprintf(&path, "%s/%s", tombstone, s->d_name)) {
+                    die("Out of memory, asprintf failed");
+                }
+                list_add(&head, &tail, path);
+            }
+        }
+        if (sub) {
+            closedir(sub);
+        }
+    }
+    if (dir) {
+        closedir(dir);
+    }
+    return head;
+}
+
+static pid_t start_removal(struct scheduler* s, struct sched_job* job, int output_fd) {
+    pid_t child_pid = xfork();
+    if (0 == child_pid) {
+        xexit(remove_tree((const char*)job->data) ? 1 : 0);
+    }
+    return child_pid;
+}
+
+static int finish_removal(struct scheduler* s, struct sched_job* job) {
+    int ok = WIFEXITED(job->status) && !WEXITSTATUS(job->status);
+    if (!ok) {
+        fprintf(stderr, "Failed to remove %s\n", job->name);
+    }
+    return !ok;
+}
+
+// Removes all tombstones of the project directory, running up to 'max_jobs' tree walkers at a time. Returns the
+// number of failures.
+static int remove_tombstones(struct ag_project* project, int max_jobs) {
+    struct list* tombstones = NULL;
+    struct list* paths = list_tombstones(project, &tombstones);
+    int count = 0;
+    for (struct list* i = paths; i; i = i->next) {
+        ++count;
+    }
+    struct scheduler* s = sched_create(count, &start_removal, &finish_removal, NULL);
+    int n = 0;
+    for (struct list* i = paths; i; i = i->next, ++n) {
+        s->jobs[n].name = (const char*)i->data;
+        s->jobs[n].data = i->data;
+    }
+    s->max_jobs = max_jobs;
+    // a subtree, which can't be removed, doesn't stop removal of the others
+    s->stop_on_failure = 0;
+    int failed = sched_run(s);
+    sched_free(s);
+    for (struct list* i = tombstones; i; i = i->next) {
+        if (remove_tree((const char*)i->data)) {
+            fprintf(stderr, "Failed to remove %s\n", (const char*)i->data);
+            ++failed;
+        }
+    }
+    list_free(paths, &free);
+    list_free(tombstones, &free);
+    return failed;
+}
+
+void remove_project(int argc, const char** argv) {
+    int yes = 0;
+    int background = 0;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_jobs = 1 < ncpu ? ncpu : 1;
+
+    while (1 <= argc) {
+        if (!strcmp("-y", *argv) || !strcmp("--yes", *argv)) {
+            yes = 1;
+        } else if (!strcmp("-b", *argv) || !strcmp("--background", *argv)) {
+            background = 1;
+        } else if (!strcmp("-j", *argv) || !strcmp("--jobs", *argv)) {
+            if (2 > argc) {
+                die("Expected number of jobs after %s", *argv);
+            }
+            --argc;
+            ++argv;
+            max_jobs = parse_jobs(*argv);
+        } else {
+            die("Unrecognized option: %s", *argv);
+        }
+        --argc;
+        ++argv;
+    }
+
+    struct ag_project* project = ag_load_default_or_die();
+    if (!yes && !confirm()) {
+        ag_free(project);
+        return;
+    }
+
+    int failed = bury_components(project);
+    if (background) {
+        pid_t child_pid = xfork();
+        if (-1 == child_pid) {
+            perror(NULL);
+            fprintf(stderr, WARN_COLOR "Unable to remove in background, removing now" COLOR_RESET "\n");
+        } else if (0 == child_pid) {
+            // detach from the terminal, so that the removal outlives the session
+            setsid();
+            int null_fd = open("/dev/null", O_RDWR);
+            if (0 <= null_fd) {
+                dup2(null_fd, STDIN_FILENO);
+                dup2(null_fd, STDOUT_FILENO);
+                dup2(null_fd, STDERR_FILENO);
+                close(null_fd);
+            }
+            remove_tombstones(project, max_jobs);
+            xexit(0);
+        } else {
+            printf(FINISH_COLOR "Removed project directories, deleting them in background" COLOR_RESET "\n");
+            ag_free(project);
+            if (failed) {
+                xexit(1);
+            }
+            return;
+        }
+    }
+    printf(START_COLOR "Removing project directories" TERM_COLOR_RESET "\n");
+    fflush(stdout);
+    failed |= remove_tombstones(project, max_jobs);
+    if (!failed) {
+        printf(FINISH_COLOR "Removed project directories" COLOR_RESET "\n");
+    }
+    ag_free(project);
+    if (failed) {
+        xexit(1);
+    }
+}
@@ -1,275 +1,1095 @@
 
 #include "agnostic.h"
+#include "scheduler.h"
+#include "spawn.h"
+#include "cgroup.h"
+#include "stamp.h"
+#include "cache.h"
+#include "watch.h"
+#include "journal.h"
+#include "durations.h"
+#include "worker.h"
+#include "selection.h"
+#include "clone.h"
 
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/wait.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
 
-static struct ag_component* extract_component(struct ag_project* project, int argc, const char** argv) {
-    struct ag_component* ret = NULL;
-    if (1 == argc) {
-        ret = ag_find_component(project, *argv);
-    } else if (2 == argc) {
-        if (!strcmp("-c", *argv)) {
-            ret = ag_find_component(project, *(argv+1));
-        } else {
-            die("Unrecognized argument: %s", *argv);
-        }
-    } else if (0 == argc) {
-        ret = ag_find_current_component(project);
-    } else {
-        die("Too many arguments");
-    }
-    if (!ret) {
-        die("Component not found");
-    }
-    return ret;
-}
+#define FINISH_COLOR TERM_COLOR_GREEN
+
+// Milliseconds without changes, after which watch mode starts a run.
+#define WATCH_QUIET_MS 200
 
 enum run_return_codes {
     NOTHING_TO_DO = 1,
     SCRIPT_FAILED,
-    SCRIPT_ABORTED
+    SCRIPT_ABORTED,
+    SCRIPT_SKIPPED,
+    SCRIPT_UP_TO_DATE,
+    SCRIPT_RESTORED,
+    SCRIPT_REPLAYED
 };
 
-static int run_component_script(struct ag_project* project, struct ag_component* c, const char* script_content) {
-    assert(project);
-    assert(c);
+enum stamp_mode {
+    STAMP_NONE,
+    STAMP_RECORD,   // record stamps of successful runs, skip up to date components
+    STAMP_DROP      // remove stamps
+};
+
+// Describes one kind of component script (build, clean, test).
+struct action {
+    const char* name;
+    const char* progress_fmt;
+    const char* nothing_fmt;
+    const char* failed_fmt;
+    const char* aborted_fmt;
+    size_t script_offset;   // offset of the script in ag_component
+    int fatal;              // if 1, any failure stops the whole run
+    enum stamp_mode stamp;
+    int cache_results;      // if 1, passing results are cached and replayed
+    int independent;        // if 1, the script of a component doesn't need results of the components it's built after
+};
+
+static const struct action build_action = {
+    "build", "Building %s", "Nothing to build: %s", "Failed to build: %s", "Building aborted: %s",
+    offsetof(struct ag_component, build), 1, STAMP_RECORD, 0, 0
+};
+
+static const struct action clean_action = {
+    "clean", "Cleaning %s", "Nothing to clean: %s", "Failed to clean: %s", "Cleaning aborted: %s",
+    offsetof(struct ag_component, clean), 0, STAMP_DROP, 0, 1
+};
+
+static const struct action test_action = {
+    "test", "Testing %s", "Nothing to test: %s", "Failed to test: %s", "Testing aborted: %s",
+    offsetof(struct ag_component, test), 0, STAMP_NONE, 1, 1
+};
+
+struct run_options {
+    int dry_run;
+    int max_jobs;
+    int adaptive;
+    int cgroup;     // run each script in its own cgroup v2 leaf
+    int force;      // ignore stamps
+    int no_cache;   // don't use the artifact cache
+    int watch;      // keep running and re-run changed components
+    int resume;     // skip components completed by the last run of the same plan
+    int shard;      // if shard_count is not 0, only components of this shard (1-based) are processed
+    int shard_count;
+    const char* workers;    // comma-separated addresses of workers to run scripts on, or NULL to run them locally
+};
+
+struct script_run {
+    struct ag_project* project;
+    const struct action* action;
+    const struct run_options* opts;
+    char* cgroup_parent;    // directory for script cgroups, if cgroups are used
+    FILE* usage_log;        // resource usage of scripts, if cgroups are used
+    struct journal* journal; // completed components are recorded here, if not NULL
+    struct worker_pool* workers; // workers to run scripts on, or NULL
+};
+
+struct script_job {
+    struct ag_component* c;
+    int skip;
+    char* script;   // temp file with the script
+    char* cgroup;   // cgroup leaf of the script
+    char* stamp;    // stamp to record after successful build
+    char* cache_key; // cache key to store outputs (or test result) under after successful run
+    int result;     // one of run_return_codes
+    long long started;  // start time of the script, or 0, if it hasn't been run
+    long long duration; // duration of the script in milliseconds
+    struct worker_host* worker; // worker running the script, or NULL
+};
+
+static const char* action_script(const struct action* a, struct ag_component* c) {
+    return *(char**)((char*)c + a->script_offset);
+}
+
+// Starts the script of the job, which is run by the scheduler as a part of the run.
+static pid_t start_script(struct script_run* r, struct scheduler* s, struct sched_job* job, int output_fd) {
+    struct script_job* j = (struct script_job*)job->data;
+    assert(r->project);
+    assert(j->c);
+
+    if (j->skip) {
+        printf(WARN_COLOR "Skipping %s" COLOR_RESET "\n", j->c->name);
+        j->result = SCRIPT_SKIPPED;
+        return 0;
+    }
+
+    const char* script_content = action_script(r->action, j->c);
+    if (STAMP_RECORD == r->action->stamp && !empty(script_content)) {
+        char* source = stamp_source_state(r->project, j->c);
+        j->stamp = stamp_compute(r->project, j->c, source);
+        char* recorded = (j->stamp && !r->opts->force) ? stamp_read(r->project, j->c) : NULL;
+        int up_to_date = recorded && !strcmp(recorded, j->stamp);
+        free(recorded);
+        if (!up_to_date && j->c->outputs && !r->opts->no_cache) {
+            j->cache_key = cache_key(r->project, j->c, source);
+        }
+        free(source);
+        if (up_to_date) {
+            printf(FINISH_COLOR "Up to date: %s" COLOR_RESET "\n", j->c->name);
+            j->result = SCRIPT_UP_TO_DATE;
+            return 0;
+        }
+        if (j->cache_key && !cache_restore(r->project, j->c, j->cache_key)) {
+            printf(FINISH_COLOR "Restored from cache: %s" COLOR_RESET "\n", j->c->name);
+            j->result = SCRIPT_RESTORED;
+            return 0;
+        }
+    } else if (r->action->cache_results && !r->opts->no_cache && !empty(script_content)) {
+        char* source = stamp_source_state(r->project, j->c);
+        j->cache_key = cache_test_key(r->project, j->c, source);
+        free(source);
+        struct buffer log = { 0 };
+        if (j->cache_key && !cache_test_restore(j->cache_key, &log)) {
+            printf(FINISH_COLOR "Passed before, replaying: %s" COLOR_RESET "\n", j->c->name);
+            fwrite(log.data, 1, log.len, stdout);
+            buffer_free(&log);
+            j->result = SCRIPT_REPLAYED;
+            return 0;
+        }
+    }
+
+    printf(PROP_COLOR);
+    printf(r->action->progress_fmt, j->c->name);
+    printf(COLOR_RESET "\n");
 
     if (!script_content || !script_content[0]) {
-        return NOTHING_TO_DO;
+        j->result = NOTHING_TO_DO;
+        return 0;
     }
 
-    char* script = create_temp_file("agnostic-script-", script_content);
-    if (!script) {
-        die("Unable to create script.");
+    if (r->workers) {
+        j->worker = worker_pool_pick(r->workers);
+        assert(j->worker);
+        char* dir = ag_component_dir(r->project, j->c);
+        fflush(stdout);
+        j->started = now_ms();
+        pid_t proxy_pid = worker_run(j->worker, dir, script_content, output_fd);
+        free(dir);
+        if (-1 == proxy_pid) {
+            perror(NULL);
+            die("Failed to run build");
+        }
+        ++j->worker->running;
+        return proxy_pid;
     }
-    char* parent_dir = ag_component_dir(project, c);
+
+    char* parent_dir = ag_component_dir(r->project, j->c);
     if (!parent_dir) {
-        remove(script);
         die("Unable to find parent directory of the component.");
     }
-    debug_print("Running script %s from parent directory %s\n", script, parent_dir);
-    pid_t child_pid = run_script(parent_dir, script);
+    // a serial run with output going to the terminal keeps scripts in the foreground process group, so that they
+    // may read from the terminal, and Ctrl-C reaches them directly; otherwise each script gets its own group, so that
+    // the scheduler can kill it with all its children
+    int new_group = s->capture || job->timeout_ms || job->stall_ms;
+    pid_t child_pid = -1;
+    if (r->cgroup_parent) {
+        // the child has to join the cgroup between fork and exec, so the script goes through a temp file
+        j->script = create_temp_file("agnostic-script-", script_content);
+        if (!j->script) {
+            die("Unable to create script.");
+        }
+        j->cgroup = cgroup_create_leaf(r->cgroup_parent, j->c->name,
+            j->c->memory_max ? j->c->memory_max : r->project->memory_max,
+            j->c->cpu_max ? j->c->cpu_max : r->project->cpu_max);
+        if (!j->cgroup) {
+            perror(NULL);
+            remove(j->script);
+            die("Unable to create cgroup for %s", j->c->name);
+        }
+        debug_print("Running script %s from parent directory %s\n", j->script, parent_dir);
+        fflush(stdout);
+        j->started = now_ms();
+        child_pid = run_script(parent_dir, j->script, output_fd, j->cgroup, new_group);
+    } else {
+        debug_print("Running script of %s from parent directory %s\n", j->c->name, parent_dir);
+        fflush(stdout);
+        j->started = now_ms();
+        child_pid = spawn_script(parent_dir, script_content, output_fd, new_group, &j->script);
+    }
+    free(parent_dir);
     if (-1 == child_pid) {
+        // e.g. the component directory is missing; the scheduler completes the job as failed, and finish_script()
+        // removes the script and the cgroup, while other jobs go on
         perror(NULL);
-        remove(script);
-        die("Failed to run build");
+        fprintf(stderr, "Failed to run script of %s\n", j->c->name);
+    }
+    return child_pid;
+}
+
+static void report_usage(struct script_run* r, struct script_job* j, int status) {
+    struct cgroup_usage u;
+    if (cgroup_read_usage(j->cgroup, &u)) {
+        printf(WARN_COLOR "Unable to read resource usage of %s" COLOR_RESET "\n", j->c->name);
+        return;
     }
+    const double mib = 1024.0 * 1024.0;
+    printf(PROP_COLOR "Resources of %s:" COLOR_RESET " CPU %.2fs user, %.2fs system", j->c->name,
+        u.user_usec / 1e6, u.system_usec / 1e6);
+    if (0 <= u.memory_peak) {
+        printf(", peak memory %.1f MiB", u.memory_peak / mib);
+    }
+    if (0 <= u.io_read) {
+        printf(", I/O %.1f MiB read, %.1f MiB written", u.io_read / mib, u.io_write / mib);
+    }
+    printf("\n");
+    if (r->usage_log) {
+        fprintf(r->usage_log, "%lld\t%s\t%s\t%d\t%lld\t%lld\t%lld\t%lld\t%lld\n", (long long)time(NULL),
+            r->action->name, j->c->name, status, u.memory_peak, u.user_usec, u.system_usec, u.io_read, u.io_write);
+        fflush(r->usage_log);
+    }
+}
 
-    int status = 0;
-    wait(&status);
+// Completes the script of the job, which is run by the scheduler as a part of the run.
+static int finish_script(struct script_run* r, struct scheduler* s, struct sched_job* job) {
+    struct script_job* j = (struct script_job*)job->data;
 
-    remove(script);
+    if (j->worker) {
+        --j->worker->running;
+        j->worker = NULL;
+    }
+    if (j->started) {
+        if (j->script) {
+            remove(j->script);
+            free(j->script);
+            j->script = NULL;
+        }
+        j->duration = now_ms() - j->started;
 
-    int ret = OK;
-    if (WIFEXITED(status)) {
-        if (WEXITSTATUS(status)) {
-            ret = SCRIPT_FAILED;
+        if (WIFEXITED(job->status) && KILL_NONE == job->killed) {
+            j->result = WEXITSTATUS(job->status) ? SCRIPT_FAILED : OK;
+        } else {
+            j->result = SCRIPT_ABORTED;
         }
-    } else {
-        ret = SCRIPT_ABORTED;
     }
 
-    free(script);
-    free(parent_dir);
-    return ret;
-}
+    if (job->output.len && !s->echo) {
+        printf(PROP_COLOR "Output of %s:" COLOR_RESET "\n", j->c->name);
+        fwrite(job->output.data, 1, job->output.len, stdout);
+    }
+    if (KILL_TIMEOUT == job->killed) {
+        printf(WARN_COLOR "Timed out after %llds: %s" COLOR_RESET "\n", job->timeout_ms / 1000, j->c->name);
+    } else if (KILL_STALL == job->killed) {
+        printf(WARN_COLOR "No output for %llds, stalled: %s" COLOR_RESET "\n", job->stall_ms / 1000, j->c->name);
+    }
+    if (j->cgroup) {
+        report_usage(r, j, job->status);
+        cgroup_remove(j->cgroup);
+        free(j->cgroup);
+        j->cgroup = NULL;
+    }
 
-static void build_component(struct ag_project* project, struct ag_component* c) {
-    assert(project);
-    assert(c);
+    if (STAMP_RECORD == r->action->stamp && SCRIPT_UP_TO_DATE != j->result) {
+        if (OK == j->result && j->cache_key) {
+            cache_store(r->project, j->c, j->cache_key);
+        } else if (SCRIPT_RESTORED != j->result) {
+            cache_forget_outputs(r->project, j->c);
+        }
+        if ((OK == j->result || SCRIPT_RESTORED == j->result) && j->stamp) {
+            stamp_write(r->project, j->c, j->stamp);
+        } else {
+            stamp_remove(r->project, j->c);
+        }
+    } else if (STAMP_DROP == r->action->stamp && NOTHING_TO_DO != j->result && SCRIPT_SKIPPED != j->result) {
+        stamp_remove(r->project, j->c);
+        cache_forget_outputs(r->project, j->c);
+    } else if (r->action->cache_results && OK == j->result && j->cache_key) {
+        cache_test_store(j->cache_key, &job->output);
+    }
+    free(j->stamp);
+    j->stamp = NULL;
+    free(j->cache_key);
+    j->cache_key = NULL;
 
-    printf(PROP_COLOR "Building %s" COLOR_RESET "\n", c->name);
+    // only components, which are done, are skipped by --resume (e.g. a missing build script fails the build)
+    switch (j->result) {
+    case OK:
+    case SCRIPT_UP_TO_DATE:
+    case SCRIPT_RESTORED:
+    case SCRIPT_REPLAYED:
+    case SCRIPT_SKIPPED:
+        if (r->journal) {
+            journal_record(r->journal, j->c->name);
+        }
+        break;
+    }
 
-    switch (run_component_script(project, c, c->build)) {
+    const char* fmt = NULL;
+    switch (j->result) {
     case NOTHING_TO_DO:
-        die("Nothing to build: %s", c->name);
+        fmt = r->action->nothing_fmt;
         break;
 
     case SCRIPT_FAILED:
-        die("Failed to build: %s", c->name);
+        fmt = r->action->failed_fmt;
         break;
 
     case SCRIPT_ABORTED:
-        die("Building aborted: %s", c->name);
+        fmt = r->action->aborted_fmt;
         break;
+    }
+    if (!fmt) {
+        return 0;
+    }
+    if (r->action->fatal) {
+        fflush(stdout);
+        fprintf(stderr, fmt, j->c->name);
+        fprintf(stderr, "\n");
+        return 1;
+    }
+    printf(fmt, j->c->name);
+    printf("\n");
+    return NOTHING_TO_DO != j->result;
+}
 
-    case OK:
-        break;
+// Returns 1, if the component is built after any of the components in the list.
+static int depends_on_any(struct ag_project* project, struct ag_component* c, struct list* list) {
+    for (struct list* b = c->build_after; b; b = b->next) {
+        struct ag_component* up = ag_find_component(project, (char*)b->data);
+        for (struct list* i = list; i; i = i->next) {
+            if (i->data == up) {
+                return 1;
+            }
+        }
     }
+    return 0;
 }
 
-static void clean_component(struct ag_project* project, struct ag_component* c) {
-    assert(project);
-    assert(c);
+// Returns components, which have changed since the given revision (or have uncommitted changes), together with
+// all components built after them, in the build order.
+static struct list* list_affected(struct ag_project* project, int argc, const char** argv) {
+    const char* since = NULL;
+    while (1 <= argc) {
+        if (!strcmp("-s", *argv) || !strcmp("--since", *argv)) {
+            if (2 > argc) {
+                die("Expected revision after %s", *argv);
+            }
+            ++argv;
+            --argc;
+            since = *argv;
+        } else {
+            die("Unrecognized argument: %s", *argv);
+        }
+        ++argv;
+        --argc;
+    }
 
-    printf(PROP_COLOR "Cleaning %s" COLOR_RESET "\n", c->name);
+    struct list* all = ag_build_all_list(project);
+    struct list* ret = NULL;
+    struct list* tail = NULL;
+    for (struct list* i = all; i; i = i->next) {
+        struct ag_component* c = (struct ag_component*)i->data;
+        // the list is in the build order, so all upstream components have already been checked
+        int affected = depends_on_any(project, c, ret);
+        if (!affected) {
+            char* dir = ag_component_dir(project, c);
+            int cloned = dir_exists(dir);
+            free(dir);
+            affected = cloned ? stamp_source_changed(project, c, since) : 0;
+            if (-1 == affected) {
+                fprintf(stderr, WARN_COLOR "Unable to find changes of %s%s%s, considering it changed" COLOR_RESET "\n",
+                    c->name, since ? " since " : "", since ? since : "");
+                affected = 1;
+            }
+        }
+        if (affected) {
+            list_add(&ret, &tail, c);
+        }
+    }
+    list_free(all, NULL);
+    return ret;
+}
 
-    switch (run_component_script(project, c, c->clean)) {
-    case NOTHING_TO_DO:
-        printf("Nothing to clean: %s\n", c->name);
-        break;
+static pid_t start_component_script(struct scheduler* s, struct sched_job* job, int output_fd) {
+    return start_script((struct script_run*)s->ctx, s, job, output_fd);
+}
 
-    case SCRIPT_FAILED:
-        printf("Failed to clean: %s\n", c->name);
-        break;
+static int finish_component_script(struct scheduler* s, struct sched_job* job) {
+    return finish_script((struct script_run*)s->ctx, s, job);
+}
 
-    case SCRIPT_ABORTED:
-        printf("Cleaning aborted: %s\n", c->name);
-        break;
+// Returns index of the given component in the array, or -1, if not found.
+static int job_index(struct script_job* jobs, int count, struct ag_component* c) {
+    for (int i = 0; i < count; ++i) {
+        if (jobs[i].c == c) {
+            return i;
+        }
+    }
+    return -1;
+}
 
-    case OK:
-        break;
+// Fills the first scheduler jobs with script jobs for components from the list, making them wait for the components
+// they're built after. Returns 1, if some of the jobs have a stall timeout.
+static int add_script_jobs(struct ag_project* project, struct list* list, int skip_disabled, struct script_job* jobs,
+    struct scheduler* s) {
+
+    int n = 0;
+    int stall_timeouts = 0;
+    for (struct list* i = list; i; i = i->next, ++n) {
+        struct ag_component* c = (struct ag_component*)i->data;
+        jobs[n].c = c;
+        jobs[n].skip = skip_disabled && c->disabled;
+        s->jobs[n].name = c->name;
+        s->jobs[n].data = jobs + n;
+        s->jobs[n].timeout_ms = 1000LL * (c->timeout ? c->timeout : project->timeout);
+        s->jobs[n].stall_ms = 1000LL * (c->stall_timeout ? c->stall_timeout : project->stall_timeout);
+        stall_timeouts |= 0 != s->jobs[n].stall_ms;
+        // only components, which go earlier in the list, are waited for, so the list order is kept for serial runs
+        for (struct list* b = c->build_after; b; b = b->next) {
+            int dep = job_index(jobs, n, ag_find_component(project, (char*)b->data));
+            if (-1 != dep) {
+                sched_depend(s, n, dep);
+            }
+        }
     }
+    return stall_timeouts;
 }
 
-static void test_component(struct ag_project* project, struct ag_component* c) {
-    assert(project);
-    assert(c);
+// Records durations of the scripts, which have been run.
+static void save_durations(struct ag_project* project, const struct action* action, struct script_job* jobs,
+    int count) {
 
-    printf(PROP_COLOR "Testing %s" COLOR_RESET "\n", c->name);
+    struct durations* durations = NULL;
+    for (int i = 0; i < count; ++i) {
+        if (jobs[i].started) {
+            durations = durations ? durations : durations_load(project, action->name);
+            durations_add(durations, jobs[i].c->name, jobs[i].duration);
+        }
+    }
+    if (durations) {
+        durations_save(durations);
+        durations_free(durations);
+    }
+}
 
-    switch (run_component_script(project, c, c->test)) {
-    case NOTHING_TO_DO:
-        printf("Nothing to test: %s\n", c->name);
-        break;
+// Runs the action for all components in the list, respecting dependencies between them.
+// If 'journal' is not NULL, completed components are recorded there. Returns the number of failed components.
+static int run_list(struct ag_project* project, const struct action* action, struct list* list, int skip_disabled,
+    const struct run_options* opts, struct journal* journal) {
 
-    case SCRIPT_FAILED:
-        printf("Failed to test: %s\n", c->name);
-        break;
+    int count = 0;
+    for (struct list* i = list; i; i = i->next) {
+        ++count;
+    }
+    struct script_job* jobs = (struct script_job*)xcalloc(count ? count : 1, sizeof(struct script_job));
+    struct script_run run = { project, action, opts, NULL, NULL, journal };
+    if (opts->cgroup) {
+        const char* error = NULL;
+        run.cgroup_parent = cgroup_setup(&error);
+        if (!run.cgroup_parent) {
+            die("Unable to use cgroups: %s", error);
+        }
+        char* log_file = ag_state_file(project, "resources.log");
+        run.usage_log = fopen(log_file, "a");
+        free(log_file);
+    }
+    if (opts->workers) {
+        char* error = NULL;
+        run.workers = worker_pool_create(opts->workers, &error);
+        if (!run.workers) {
+            die("Unable to use workers: %s", error);
+        }
+    }
+    struct scheduler* s = sched_create(count, &start_component_script, &finish_component_script, &run);
 
-    case SCRIPT_ABORTED:
-        printf("Testing aborted: %s\n", c->name);
-        break;
+    int stall_timeouts = add_script_jobs(project, list, skip_disabled, jobs, s);
 
-    case OK:
-        break;
+    FILE* log = NULL;
+    s->max_jobs = opts->max_jobs;
+    if (run.workers && (!s->max_jobs || s->max_jobs > run.workers->slots)) {
+        s->max_jobs = run.workers->slots;
+    }
+    s->stop_on_failure = action->fatal;
+    if (opts->adaptive) {
+        char* log_file = ag_state_file(project, "adaptive.log");
+        log = fopen(log_file, "a");
+        free(log_file);
+        s->pressure = pressure_create(opts->max_jobs, log);
+    }
+    s->capture = opts->adaptive || 1 < s->max_jobs;
+    if (((action->cache_results && !opts->no_cache) || stall_timeouts) && !s->capture) {
+        // output is needed to replay results later, or to notice stalls, but it's still shown as it goes
+        s->capture = 1;
+        s->echo = 1;
+    }
+
+    int ret = sched_run(s);
+    save_durations(project, action, jobs, count);
+
+    if (s->pressure) {
+        pressure_free(s->pressure);
+    }
+    if (log) {
+        fclose(log);
     }
+    if (run.usage_log) {
+        fclose(run.usage_log);
+    }
+    free(run.cgroup_parent);
+    worker_pool_free(run.workers);
+    sched_free(s);
+    free(jobs);
+    return ret;
 }
 
-static struct list* list_current(struct ag_project* project) {
-    return list_create(extract_component(project, 0, NULL), NULL);
+// Returns 1, if the component has a stamp, and the stamp hasn't changed.
+static int stamp_unchanged(struct ag_project* project, struct ag_component* c) {
+    char* source = stamp_source_state(project, c);
+    char* stamp = stamp_compute(project, c, source);
+    char* recorded = stamp ? stamp_read(project, c) : NULL;
+    int ret = recorded && !strcmp(recorded, stamp);
+    free(recorded);
+    free(stamp);
+    free(source);
+    return ret;
 }
 
-static struct list* list_list(struct ag_project* project, int argc, const char** argv) {
+// Runs the action for the list, then re-runs it for changed components and components depending on them,
+// whenever files of the components change. Never returns.
+static void watch_list(struct ag_project* project, const struct action* action, struct list* list, int skip_disabled,
+    const struct run_options* opts) {
+
+    int count = 0;
+    for (struct list* i = list; i; i = i->next) {
+        ++count;
+    }
+    struct ag_component** comps = (struct ag_component**)xcalloc(count ? count : 1, sizeof(struct ag_component*));
+    struct list** ignores = (struct list**)xcalloc(count ? count : 1, sizeof(struct list*));
+    char* changed = (char*)xcalloc(count ? count : 1, 1);
+    char* during = (char*)xcalloc(count ? count : 1, 1);
+    struct watch* w = watch_create();
+    if (!w) {
+        die("Watching for changes is not supported");
+    }
+    int watched = 0;
+    int n = 0;
+    for (struct list* i = list; i; i = i->next, ++n) {
+        comps[n] = (struct ag_component*)i->data;
+        if (skip_disabled && comps[n]->disabled) {
+            continue;
+        }
+        // VCS metadata and build outputs change without changes of sources
+        ignores[n] = list_create(".git", list_create(".hg", list_create(AG_STATE_DIR, NULL)));
+        for (struct list* o = comps[n]->outputs; o; o = o->next) {
+            ignores[n] = list_create(o->data, ignores[n]);
+        }
+        char* dir = ag_component_dir(project, comps[n]);
+        if (!watch_add_tree(w, dir, n, ignores[n])) {
+            ++watched;
+        } else {
+            fprintf(stderr, WARN_COLOR "Unable to watch %s" COLOR_RESET "\n", comps[n]->name);
+        }
+        free(dir);
+    }
+    if (!watched) {
+        die("Nothing to watch");
+    }
+
+    run_list(project, action, list, skip_disabled, opts, NULL);
+    int report = 1;
+    while (1) {
+        if (report) {
+            printf(PROP_COLOR "Watching %d components for changes..." COLOR_RESET "\n", watched);
+            fflush(stdout);
+        }
+        report = 0;
+        if (watch_wait(w, changed, count, WATCH_QUIET_MS)) {
+            perror(NULL);
+            die("Failed to watch for changes");
+        }
+
+        struct list* next = NULL;
+        struct list* tail = NULL;
+        for (int i = 0; i < count; ++i) {
+            struct ag_component* c = comps[i];
+            // components are in the build order, so the components they depend on have been checked already
+            int run = depends_on_any(project, c, next);
+            if (!run && changed[i]) {
+                // changes of ignored files (e.g. build results, which are not declared as outputs) don't matter
+                run = !(STAMP_RECORD == action->stamp && stamp_unchanged(project, c));
+            }
+            if (run) {
+                list_add(&next, &tail, c);
+            }
+        }
+        memset(changed, 0, count);
+        if (!next) {
+            continue;
+        }
+
+        run_list(project, action, next, skip_disabled, opts, NULL);
+        report = 1;
+
+        // changes made by the run itself can only be told apart from changes of sources by stamps,
+        // so for components, which can't be stamped, changes made during their run are dropped
+        memset(during, 0, count);
+        watch_drain(w, during);
+        for (int i = 0; i < count; ++i) {
+            int was_run = 0;
+            for (struct list* l = next; l && !was_run; l = l->next) {
+                was_run = l->data == comps[i];
+            }
+            char* source = (during[i] && was_run) ? stamp_source_state(project, comps[i]) : NULL;
+            changed[i] = during[i] && (!was_run || source);
+            free(source);
+        }
+        list_free(next, NULL);
+    }
+}
+
+// Removes components, which have been completed by the last run of the same plan, from the list.
+// Returns the new list. Sets '*resumed' to 0, if there's no run of the plan to resume.
+static struct list* resume_list(struct ag_project* project, const struct action* action, struct list* list,
+    const char* plan, int* resumed) {
+
+    struct list* done = NULL;
+    int complete = 0;
+    if (journal_load(project, action->name, plan, &done, &complete)) {
+        fprintf(stderr, WARN_COLOR "No %s run of these components to resume, starting from the beginning"
+            COLOR_RESET "\n", action->name);
+        *resumed = 0;
+        return list;
+    }
     struct list* ret = NULL;
     struct list* tail = NULL;
-    while (0 < argc) {
-        struct ag_component* c = ag_find_component(project, *argv);
-        // TODO: re-write this to support -c and use extract_component()
-        if (!c) {
-            die("Component not found: %s", *argv);
+    int count = 0;
+    int skipped = 0;
+    for (struct list* i = list; i; i = i->next, ++count) {
+        struct ag_component* c = (struct ag_component*)i->data;
+        int is_done = 0;
+        for (struct list* d = done; d && !is_done; d = d->next) {
+            is_done = !strcmp(c->name, (char*)d->data);
         }
-        --argc;
-        ++argv;
-        list_add(&ret, &tail, c);
+        if (is_done) {
+            ++skipped;
+        } else {
+            list_add(&ret, &tail, c);
+        }
+    }
+    if (complete && !ret) {
+        printf(FINISH_COLOR "The last %s run of these components has completed, nothing to resume" COLOR_RESET "\n",
+            action->name);
+    } else {
+        printf(FINISH_COLOR "Resuming %s: %d of %d components are already done" COLOR_RESET "\n",
+            action->name, skipped, count);
     }
+    list_free(done, &free);
+    list_free(list, NULL);
     return ret;
 }
 
-static struct list* list_up_down(struct ag_project* project, int up, int* skip_disabled, int argc, const char** argv) {
-    const char* up_to = NULL;
+struct shard_unit {
+    int first;          // index of the first component of the unit in the list
+    long long weight;   // expected duration of the unit
+    int shard;
+};
 
-    while (1 <= argc) {
-        if (!strcmp("-t", *argv) || !strcmp("--to", *argv)) {
-            if (2 > argc) {
-                die("Expected component name/alias after %s", *argv);
+static int compare_units(const void* a, const void* b) {
+    const struct shard_unit* x = (const struct shard_unit*)a;
+    const struct shard_unit* y = (const struct shard_unit*)b;
+    if (x->weight != y->weight) {
+        return x->weight < y->weight ? 1 : -1;
+    }
+    return x->first - y->first;
+}
+
+static int find_root(int* parent, int i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+// Returns the components of the given shard (1-based) out of 'count' shards, in the list order. The list is split
+// into units: single components, or, if the action needs results of upstream components, groups of components,
+// which are connected by build dependencies. Units are assigned to shards greedily, longest first, to the least
+// loaded shard, using historical durations of the script (or counts of components, if there's no history).
+static struct list* shard_list(struct ag_project* project, const struct action* action, struct list* list,
+    int skip_disabled, int shard, int count, int quiet) {
+
+    int n = 0;
+    for (struct list* i = list; i; i = i->next) {
+        ++n;
+    }
+    struct ag_component** comps = (struct ag_component**)xcalloc(n ? n : 1, sizeof(struct ag_component*));
+    int* parent = (int*)xcalloc(n ? n : 1, sizeof(int));
+    long long* weight = (long long*)xcalloc(n ? n : 1, sizeof(long long));
+    int k = 0;
+    for (struct list* i = list; i; i = i->next, ++k) {
+        comps[k] = (struct ag_component*)i->data;
+        parent[k] = k;
+    }
+
+    struct durations* durations = durations_load(project, action->name);
+    long long known = 0;
+    long long total = 0;
+    for (int i = 0; i < n; ++i) {
+        weight[i] = durations_get(durations, comps[i]->name);
+        if (0 <= weight[i]) {
+            ++known;
+            total += weight[i];
+        }
+    }
+    durations_free(durations);
+    // components without history are expected to take an average time
+    long long average = known ? (total / known > 0 ? total / known : 1) : 1;
+    for (int i = 0; i < n; ++i) {
+        weight[i] = 0 > weight[i] ? average : (known ? weight[i] : 1);
+        if (skip_disabled && comps[i]->disabled) {
+            weight[i] = 0;
+        }
+    }
+
+    if (!action->independent) {
+        for (int i = 0; i < n; ++i) {
+            for (struct list* b = comps[i]->build_after; b; b = b->next) {
+                struct ag_component* up = ag_find_component(project, (char*)b->data);
+                for (int j = 0; j < n; ++j) {
+                    if (comps[j] == up) {
+                        parent[find_root(parent, i)] = find_root(parent, j);
+                    }
+                }
             }
-            ++argv;
-            --argc;
-            up_to = *argv;
-        } else {
-            break;
         }
-        ++argv;
-        --argc;
     }
-    *skip_disabled = (NULL == up_to);
+
+    struct shard_unit* units = (struct shard_unit*)xcalloc(n ? n : 1, sizeof(struct shard_unit));
+    int unit_count = 0;
+    for (int i = 0; i < n; ++i) {
+        int root = find_root(parent, i);
+        int u = 0;
+        while (u < unit_count && find_root(parent, units[u].first) != root) {
+            ++u;
+        }
+        if (u == unit_count) {
+            units[unit_count++].first = i;
+        }
+        units[u].weight += weight[i];
+    }
+    qsort(units, unit_count, sizeof(struct shard_unit), &compare_units);
+
+    long long* load = (long long*)xcalloc(count, sizeof(long long));
+    for (int u = 0; u < unit_count; ++u) {
+        int least = 0;
+        for (int s = 1; s < count; ++s) {
+            if (load[s] < load[least]) {
+                least = s;
+            }
+        }
+        units[u].shard = least;
+        load[least] += units[u].weight;
+    }
 
     struct list* ret = NULL;
-    int rc = 0;
-    if (up) {
-        ret = ag_build_up_list(project, extract_component(project, argc, argv), up_to, &rc);
-    } else {
-        ret = ag_build_down_list(project, extract_component(project, argc, argv), up_to, &rc);
+    struct list* tail = NULL;
+    int selected = 0;
+    for (int i = 0; i < n; ++i) {
+        int root = find_root(parent, i);
+        for (int u = 0; u < unit_count; ++u) {
+            if (find_root(parent, units[u].first) == root && shard - 1 == units[u].shard) {
+                list_add(&ret, &tail, comps[i]);
+                ++selected;
+            }
+        }
     }
-    if (!ret) {
-        die("Failed to resolve build order. %s.", ag_error_msg(rc));
+    if (!quiet) {
+        if (known) {
+            printf(PROP_COLOR "Shard %d/%d:" COLOR_RESET " %d of %d components, expected time %.1fs\n",
+                shard, count, selected, n, load[shard - 1] / 1000.0);
+        } else {
+            printf(PROP_COLOR "Shard %d/%d:" COLOR_RESET " %d of %d components\n", shard, count, selected, n);
+        }
     }
+
+    free(load);
+    free(units);
+    free(weight);
+    free(parent);
+    free(comps);
+    list_free(list, NULL);
     return ret;
 }
 
-static struct list* list_all(struct ag_project* project) {
-    return ag_build_all_list(project);
+static void parse_shard(const char* s, struct run_options* opts) {
+    char* end = NULL;
+    long k = strtol(s, &end, 10);
+    long n = ('/' == *end) ? strtol(end + 1, &end, 10) : 0;
+    if (*end || 1 > k || 1 > n || k > n || n > 4096) {
+        die("Invalid shard: %s, expected K/N, where 1 <= K <= N", s);
+    }
+    opts->shard = (int)k;
+    opts->shard_count = (int)n;
 }
 
-static void perform_main(void (*p)(struct ag_project*, struct ag_component*), int argc, const char** argv) {
+static void perform_main(const struct action* action, int argc, const char** argv) {
     struct ag_project* project = ag_load_default_or_die();
 
-    int dry_run = 0;
+    struct run_options opts = { 0 };
     int skip_disabled = 0;
 
     // options
     while (1 <= argc) {
         if (!strcmp("-n", *argv) || !strcmp("--dry-run", *argv)) {
-            dry_run = 1;
+            opts.dry_run = 1;
+        } else if (!strcmp("-j", *argv) || !strcmp("--jobs", *argv)) {
+            if (2 > argc) {
+                die("Expected number of jobs after %s", *argv);
+            }
+            --argc;
+            ++argv;
+            opts.max_jobs = parse_jobs(*argv);
+        } else if (!strcmp("-a", *argv) || !strcmp("--adaptive", *argv)) {
+            opts.adaptive = 1;
+        } else if (!strcmp("--cgroup", *argv)) {
+            opts.cgroup = 1;
+        } else if (!strcmp("-f", *argv) || !strcmp("--force", *argv)) {
+            opts.force = 1;
+        } else if (!strcmp("--no-cache", *argv)) {
+            opts.no_cache = 1;
+        } else if (!strcmp("-w", *argv) || !strcmp("--watch", *argv)) {
+            opts.watch = 1;
+        } else if (!strcmp("-r", *argv) || !strcmp("--resume", *argv)) {
+            opts.resume = 1;
+        } else if (!strcmp("--workers", *argv)) {
+            if (2 > argc) {
+                die("Expected worker addresses after %s", *argv);
+            }
+            --argc;
+            ++argv;
+            opts.workers = *argv;
+        } else if (!strcmp("--shard", *argv)) {
+            if (2 > argc) {
+                die("Expected K/N after %s", *argv);
+            }
+            --argc;
+            ++argv;
+            parse_shard(*argv, &opts);
         } else {
             break;
         }
         --argc;
         ++argv;
     }
+    if (opts.workers && (opts.adaptive || opts.cgroup)) {
+        die("Options --adaptive and --cgroup can't be used with --workers");
+    }
+    if (!opts.max_jobs && !opts.workers) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        opts.max_jobs = opts.adaptive ? 2 * (1 < ncpu ? ncpu : 1) : 1;
+    }
 
     struct list* list = NULL;
 
     // command
-    if (1 <= argc) {
-        if (!strcmp("up", *argv)) {
-            list = list_up_down(project, 1, &skip_disabled, argc-1, argv+1);
-
-        } else if (!strcmp("down", *argv)) {
-            list = list_up_down(project, 0, &skip_disabled, argc-1, argv+1);
-            
-        } else if (!strcmp("all", *argv)) {
-            list = list_all(project);
-            skip_disabled = 1;
-            
-        } else {
-            list = list_list(project, argc, argv);
-        }
+    if (1 <= argc && !strcmp("affected", *argv)) {
+        list = list_affected(project, argc-1, argv+1);
+        skip_disabled = 1;
     } else {
-        list = list_current(project);
+        list = select_components(project, argc, argv, &skip_disabled);
     }
 
-    for (struct list* i = list; i; i = i->next) {
-        struct ag_component* c = (struct ag_component*)i->data;
-        int skip = skip_disabled && c->disabled;
-        if (dry_run) {
-            if (!skip) {
+    if (opts.shard_count) {
+        list = shard_list(project, action, list, skip_disabled, opts.shard, opts.shard_count, opts.dry_run);
+    }
+
+    char plan[DIGEST_HEX_SIZE];
+    journal_plan(project, list, skip_disabled, plan);
+    if (opts.resume && !opts.watch) {
+        list = resume_list(project, action, list, plan, &opts.resume);
+    }
+
+    int failed = 0;
+    if (opts.watch && !opts.dry_run) {
+        watch_list(project, action, list, skip_disabled, &opts);
+    } else if (opts.dry_run) {
+        for (struct list* i = list; i; i = i->next) {
+            struct ag_component* c = (struct ag_component*)i->data;
+            if (!(skip_disabled && c->disabled)) {
                 printf("%s\n", c->name);
             }
-        } else if (skip) {
-            printf(WARN_COLOR "Skipping %s" COLOR_RESET "\n", c->name);
-        } else {
-            p(project, c);
         }
+    } else {
+        struct journal* journal = journal_start(project, action->name, plan, opts.resume);
+        if (!journal) {
+            fprintf(stderr, WARN_COLOR "Unable to record %s journal, the run won't be resumable" COLOR_RESET "\n",
+                action->name);
+        }
+        failed = run_list(project, action, list, skip_disabled, &opts, journal);
+        journal_finish(journal, 0 == failed);
     }
 
     list_free(list, NULL);
-    ag_free(project);    
+    ag_free(project);
+    if (failed && action->fatal) {
+        xexit(1);
+    }
 }
 
 void build(int argc, const char** argv) {
-    perform_main(&build_component, argc, argv);
+    perform_main(&build_action, argc, argv);
 }
 
 void clean(int argc, const char** argv) {
-    perform_main(&clean_component, argc, argv);
+    perform_main(&clean_action, argc, argv);
 }
 
 void test(int argc, const char** argv) {
-    perform_main(&test_component, argc, argv);
+    perform_main(&test_action, argc, argv);
+}
+
+// Clone and build jobs of 'ag bootstrap'. Build jobs go first, so that ready builds are started before pending
+// clones. A failed clone doesn't stop the run: only builds, which depend on it, are not run.
+struct bootstrap_run {
+    struct script_run run;
+    struct clone_job* clones;
+    int build_count;
+    const char** missing;   // for each job, the component, which hasn't been cloned, if the job depends on it
+    int not_cloned;
+    int not_built;
+};
+
+// Marks the jobs, which depend on the job, as unable to run, as the component hasn't been cloned.
+static void mark_missing(struct bootstrap_run* b, struct scheduler* s, struct sched_job* job, const char* name) {
+    for (struct list* l = job->dependents; l; l = l->next) {
+        int i = (struct sched_job*)l->data - s->jobs;
+        if (!b->missing[i]) {
+            b->missing[i] = name;
+        }
+    }
+}
+
+static pid_t start_bootstrap_job(struct scheduler* s, struct sched_job* job, int output_fd) {
+    struct bootstrap_run* b = (struct bootstrap_run*)s->ctx;
+    int i = job - s->jobs;
+    if (b->missing[i]) {
+        printf(WARN_COLOR "Not building %s, as %s isn't cloned" COLOR_RESET "\n", job->name, b->missing[i]);
+        ++b->not_built;
+        mark_missing(b, s, job, b->missing[i]);
+        return 0;
+    }
+    return i < b->build_count ? start_script(&b->run, s, job, output_fd)
+        : clone_job_start(b->clones + i - b->build_count, output_fd);
+}
+
+static int finish_bootstrap_job(struct scheduler* s, struct sched_job* job) {
+    struct bootstrap_run* b = (struct bootstrap_run*)s->ctx;
+    int i = job - s->jobs;
+    if (b->missing[i]) {
+        return 0;
+    }
+    if (i < b->build_count) {
+        return finish_script(&b->run, s, job);
+    }
+    if (clone_job_finish(b->clones + i - b->build_count, job)) {
+        // other clones, and builds, which don't need this one, go on
+        ++b->not_cloned;
+        mark_missing(b, s, job, job->name);
+    }
+    return 0;
+}
+
+void bootstrap(int argc, const char** argv) {
+    struct run_options opts = { 0 };
+    int use_mirror = 0;
+
+    while (1 <= argc) {
+        if (!strcmp("-j", *argv) || !strcmp("--jobs", *argv)) {
+            if (2 > argc) {
+                die("Expected number of jobs after %s", *argv);
+            }
+            --argc;
+            ++argv;
+            opts.max_jobs = parse_jobs(*argv);
+        } else if (!strcmp("--mirror", *argv)) {
+            use_mirror = 1;
+        } else if (!strcmp("-f", *argv) || !strcmp("--force", *argv)) {
+            opts.force = 1;
+        } else if (!strcmp("--no-cache", *argv)) {
+            opts.no_cache = 1;
+        } else if (0 < strlen(*argv) && '-' == (*argv)[0]) {
+            die("Unrecognized option: %s", *argv);
+        } else {
+            break;
+        }
+        --argc;
+        ++argv;
+    }
+    if (!opts.max_jobs) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        opts.max_jobs = 1 < ncpu ? ncpu : 1;
+    }
+
+    struct ag_project* project = ag_load_default_or_die();
+    int skip_disabled = 1;
+    struct list* list = NULL;
+    if (0 == argc) {
+        // there's no current component yet, so bootstrap everything by default
+        list = ag_build_all_list(project);
+    } else {
+        list = select_components(project, argc, argv, &skip_disabled);
+    }
+
+    int build_count = 0;
+    for (struct list* i = list; i; i = i->next) {
+        ++build_count;
+    }
+    int clone_count = 0;
+    struct clone_job* clones = clone_jobs_create(project, list, skip_disabled, use_mirror, 1 < opts.max_jobs,
+        &clone_count);
+    struct script_job* jobs = (struct script_job*)xcalloc(build_count ? build_count : 1, sizeof(struct script_job));
+    struct bootstrap_run b = { { project, &build_action, &opts, NULL, NULL, NULL, NULL }, clones, build_count,
+        (const char**)xcalloc(build_count + clone_count + 1, sizeof(const char*)), 0, 0 };
+    struct scheduler* s = sched_create(build_count + clone_count, &start_bootstrap_job, &finish_bootstrap_job, &b);
+
+    int stall_timeouts = add_script_jobs(project, list, skip_disabled, jobs, s);
+    for (int i = 0; i < clone_count; ++i) {
+        int n = build_count + i;
+        s->jobs[n].name = clones[i].c->name;
+        s->jobs[n].data = clones + i;
+        if (-1 != clones[i].mirror_job) {
+            sched_depend(s, n, build_count + clones[i].mirror_job);
+        }
+        if (!clones[i].mirror) {
+            // the component is built as soon as its own repository is cloned
+            int build = job_index(jobs, build_count, clones[i].c);
+            if (-1 != build) {
+                sched_depend(s, build, n);
+            }
+        }
+    }
+
+    s->max_jobs = opts.max_jobs;
+    s->stop_on_failure = 1;
+    s->capture = 1 < s->max_jobs;
+    if (stall_timeouts && !s->capture) {
+        s->capture = 1;
+        s->echo = 1;
+    }
+    int failed = sched_run(s);
+    save_durations(project, &build_action, jobs, build_count);
+    if (b.not_cloned) {
+        fflush(stdout);
+        fprintf(stderr, "Not cloned: %d components, not built because of that: %d components\n", b.not_cloned,
+            b.not_built);
+    }
+
+    sched_free(s);
+    clone_jobs_free(clones, clone_count);
+    free(b.missing);
+    free(jobs);
+    list_free(list, NULL);
+    ag_free(project);
+    if (failed || b.not_cloned) {
+        xexit(1);
+    }
 }
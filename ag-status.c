@@ -0,0 +1,274 @@
+// for asprintf()
+#define _GNU_SOURCE
+
+#include "agnostic.h"
+#include "scheduler.h"
+#include "selection.h"
+
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CLEAN_COLOR TERM_COLOR_GREEN
+
+// Number of concurrent status queries per CPU. Queries mostly wait for the file system, so there may be more of them
+// than CPUs.
+#define STATUS_JOBS_PER_CPU 2
+
+struct status_job {
+    struct ag_component* c;
+    char* cmdline;
+    int done;           // 1, if the query has completed
+    int ok;             // 1, if the status has been read
+    char* branch;       // current branch, or NULL, if HEAD is detached
+    char* upstream;     // upstream branch, or NULL, if there's none (or it's unknown)
+    int ahead;          // commits, which aren't in the upstream branch, or -1, if unknown
+    int behind;         // commits of the upstream branch, which aren't here, or -1, if unknown
+    int staged;         // changes, which are added to the index
+    int modified;       // changes of tracked files, which aren't added to the index
+    int untracked;
+    int conflicts;
+};
+
+// Returns the command line, which prints the status of the repository in the given directory in porcelain format,
+// or NULL, if the component has no repository. The untracked cache is always used by Git (it's only stored, when the
+// index is written anyway), fsmonitor is used, if the repository is configured for it.
+static char* status_cmdline(struct ag_component* c, const char* dir) {
+    char* qdir = shell_quote(dir);
+    char* ret = NULL;
+    int rc = 0;
+    if (c->git) {
+        rc = asprintf(&ret, "git -C %s -c core.untrackedCache=true status --porcelain=v2 --branch", qdir);
+    } else if (c->hg) {
+        rc = asprintf(&ret, "cd %s && echo \"# branch.head $(hg branch)\" && hg status", qdir);
+    }
+    if (-1 == rc) {
+        die("Out of memory, asprintf failed");
+    }
+    free(qdir);
+    return ret;
+}
+
+// Parses 'git status --porcelain=v2 --branch' output, or 'hg status' output, preceded by the branch header.
+static void parse_status(struct status_job* j, char* output) {
+    j->ahead = -1;
+    j->behind = -1;
+    for (char* line = strtok(output, "\n"); line; line = strtok(NULL, "\n")) {
+        if (!strncmp("# branch.head ", line, 14)) {
+            free(j->branch);
+            j->branch = strcmp("(detached)", line + 14) ? xstrdup(line + 14) : NULL;
+        } else if (!strncmp("# branch.upstream ", line, 18)) {
+            free(j->upstream);
+            j->upstream = xstrdup(line + 18);
+        } else if (!strncmp("# branch.ab ", line, 12)) {
+            if (2 != sscanf(line + 12, "+%d -%d", &j->ahead, &j->behind)) {
+                j->ahead = -1;
+                j->behind = -1;
+            }
+        } else if (j->c->git && ('1' == line[0] || '2' == line[0]) && ' ' == line[1] && line[2] && line[3]) {
+            // "1 XY ...", X is the index status, Y is the work tree status, '.' means unchanged
+            j->staged += '.' != line[2];
+            j->modified += '.' != line[3];
+        } else if (j->c->git && 'u' == line[0] && ' ' == line[1]) {
+            j->conflicts++;
+        } else if ('?' == line[0] && ' ' == line[1]) {
+            j->untracked++;
+        } else if (j->c->hg && line[0] && strchr("MAR!", line[0]) && ' ' == line[1]) {
+            j->modified++;
+        }
+    }
+}
+
+static pid_t start_status(struct scheduler* s, struct sched_job* job, int output_fd) {
+    struct status_job* j = (struct status_job*)job->data;
+    pid_t child_pid = run_cmd_line(j->cmdline, output_fd);
+    if (-1 == child_pid) {
+        perror(NULL);
+        fprintf(stderr, "Failed to query status of %s\n", j->c->name);
+    }
+    return child_pid;
+}
+
+static int finish_status(struct scheduler* s, struct sched_job* job) {
+    struct status_job* j = (struct status_job*)job->data;
+    j->done = 1;
+    if (!WIFEXITED(job->status) || WEXITSTATUS(job->status)) {
+        if (job->output.len) {
+            fprintf(stderr, PROP_COLOR "Output of %s:" COLOR_RESET "\n", j->c->name);
+            fwrite(job->output.data, 1, job->output.len, stderr);
+        }
+        fprintf(stderr, "Failed to query status of %s\n", j->c->name);
+        return 1;
+    }
+    parse_status(j, job->output.data ? job->output.data : "");
+    j->ok = 1;
+    return 0;
+}
+
+// Returns the reason, why the status of the job is unknown, or NULL, if it's known.
+static const char* unknown_status(struct status_job* j) {
+    return j->ok ? NULL : j->done ? "failed" : "not queried";
+}
+
+static int is_clean(struct status_job* j) {
+    return !j->staged && !j->modified && !j->untracked && !j->conflicts && 0 >= j->ahead && 0 >= j->behind;
+}
+
+static void print_json_string(const char* s) {
+    if (!s) {
+        printf("null");
+        return;
+    }
+    putchar('"');
+    for (const unsigned char* p = (const unsigned char*)s; *p; ++p) {
+        if ('"' == *p || '\\' == *p) {
+            printf("\\%c", *p);
+        } else if (0x20 > *p) {
+            printf("\\u%04x", *p);
+        } else {
+            putchar(*p);
+        }
+    }
+    putchar('"');
+}
+
+static void print_json(struct status_job* jobs, int count) {
+    printf("[");
+    int first = 1;
+    for (int i = 0; i < count; ++i) {
+        struct status_job* j = jobs + i;
+        printf("%s\n  {\"name\": ", first ? "" : ",");
+        first = 0;
+        print_json_string(j->c->name);
+        printf(", \"vcs\": \"%s\"", j->c->git ? "git" : "hg");
+        if (unknown_status(j)) {
+            printf(", \"error\": \"%s\"}", unknown_status(j));
+            continue;
+        }
+        printf(", \"branch\": ");
+        print_json_string(j->branch);
+        printf(", \"upstream\": ");
+        print_json_string(j->upstream);
+        if (0 <= j->ahead) {
+            printf(", \"ahead\": %d, \"behind\": %d", j->ahead, j->behind);
+        } else {
+            printf(", \"ahead\": null, \"behind\": null");
+        }
+        printf(", \"staged\": %d, \"modified\": %d, \"untracked\": %d, \"conflicts\": %d, \"clean\": %s}",
+            j->staged, j->modified, j->untracked, j->conflicts, is_clean(j) ? "true" : "false");
+    }
+    printf("%s]\n", first ? "" : "\n");
+}
+
+static void print_table(struct status_job* jobs, int count) {
+    int name_width = 9;
+    int branch_width = 6;
+    for (int i = 0; i < count; ++i) {
+        int n = strlen(jobs[i].c->name);
+        int b = jobs[i].branch ? strlen(jobs[i].branch) : 10;
+        name_width = n > name_width ? n : name_width;
+        branch_width = b > branch_width ? b : branch_width;
+    }
+    printf(PROP_COLOR "%-*s  %-*s  %6s %6s %6s %8s %9s %9s" COLOR_RESET "\n", name_width, "COMPONENT",
+        branch_width, "BRANCH", "AHEAD", "BEHIND", "STAGED", "MODIFIED", "UNTRACKED", "CONFLICTS");
+    for (int i = 0; i < count; ++i) {
+        struct status_job* j = jobs + i;
+        if (unknown_status(j)) {
+            printf(WARN_COLOR "%-*s" COLOR_RESET "  (%s)\n", name_width, j->c->name, unknown_status(j));
+            continue;
+        }
+        char ahead[16] = "-";
+        char behind[16] = "-";
+        if (0 <= j->ahead) {
+            snprintf(ahead, sizeof(ahead), "%d", j->ahead);
+            snprintf(behind, sizeof(behind), "%d", j->behind);
+        }
+        printf("%s%-*s%s  %-*s  %6s %6s %6d %8d %9d %9d\n", is_clean(j) ? CLEAN_COLOR : WARN_COLOR, name_width,
+            j->c->name, COLOR_RESET, branch_width, j->branch ? j->branch : "(detached)", ahead, behind, j->staged,
+            j->modified, j->untracked, j->conflicts);
+    }
+}
+
+void status(int argc, const char** argv) {
+    int json = 0;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_jobs = STATUS_JOBS_PER_CPU * (1 < ncpu ? ncpu : 1);
+
+    while (1 <= argc) {
+        if (!strcmp("-j", *argv) || !strcmp("--jobs", *argv)) {
+            if (2 > argc) {
+                die("Expected number of jobs after %s", *argv);
+            }
+            --argc;
+            ++argv;
+            max_jobs = parse_jobs(*argv);
+        } else if (!strcmp("--json", *argv)) {
+            json = 1;
+        } else if (0 < strlen(*argv) && '-' == (*argv)[0]) {
+            die("Unrecognized option: %s", *argv);
+        } else {
+            break;
+        }
+        --argc;
+        ++argv;
+    }
+
+    struct ag_project* project = ag_load_default_or_die();
+    int skip_disabled = 0;
+    struct list* list = NULL;
+    if (0 == argc) {
+        // the whole workspace by default
+        list = ag_build_all_list(project);
+    } else {
+        list = select_components(project, argc, argv, &skip_disabled);
+    }
+
+    int count = 0;
+    for (struct list* i = list; i; i = i->next) {
+        ++count;
+    }
+    struct status_job* jobs = (struct status_job*)xcalloc(count ? count : 1, sizeof(struct status_job));
+    int n = 0;
+    for (struct list* i = list; i; i = i->next) {
+        struct ag_component* c = (struct ag_component*)i->data;
+        char* dir = ag_component_dir(project, c);
+        if (!(skip_disabled && c->disabled) && dir_exists(dir)) {
+            jobs[n].c = c;
+            jobs[n].cmdline = status_cmdline(c, dir);
+            n += NULL != jobs[n].cmdline;
+        }
+        free(dir);
+    }
+
+    struct scheduler* s = sched_create(n, &start_status, &finish_status, NULL);
+    for (int i = 0; i < n; ++i) {
+        s->jobs[i].name = jobs[i].c->name;
+        s->jobs[i].data = jobs + i;
+    }
+    s->max_jobs = max_jobs;
+    // a broken repository doesn't hide the status of the others
+    s->stop_on_failure = 0;
+    s->capture = 1;
+    int failed = sched_run(s);
+    sched_free(s);
+
+    if (json) {
+        print_json(jobs, n);
+    } else {
+        print_table(jobs, n);
+    }
+
+    for (int i = 0; i < n; ++i) {
+        free(jobs[i].cmdline);
+        free(jobs[i].branch);
+        free(jobs[i].upstream);
+    }
+    free(jobs);
+    list_free(list, NULL);
+    ag_free(project);
+    if (failed) {
+        xexit(1);
+    }
+}
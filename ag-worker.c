@@ -0,0 +1,37 @@
+
+#include "agnostic.h"
+#include "worker.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+void worker(int argc, const char** argv) {
+    const char* address = NULL;
+    long slots = sysconf(_SC_NPROCESSORS_ONLN);
+    while (1 <= argc) {
+        if (!strcmp("-j", *argv) || !strcmp("--jobs", *argv)) {
+            if (2 > argc) {
+                die("Expected number of jobs after %s", *argv);
+            }
+            --argc;
+            ++argv;
+            char* end = NULL;
+            slots = strtol(*argv, &end, 10);
+            if (!**argv || *end || 1 > slots || slots > 4096) {
+                die("Invalid number of jobs: %s", *argv);
+            }
+        } else if (!address) {
+            address = *argv;
+        } else {
+            die("Unknown argument: %s", *argv);
+        }
+        --argc;
+        ++argv;
+    }
+    if (!address) {
+        die("Expected address to listen on");
+    }
+    xexit(worker_serve(address, 1 > slots ? 1 : (int)slots));
+}
@@ -18,7 +18,16 @@ extern void component(int argc, const char** argv);
 extern void build(int argc, const char** argv);
 extern void clean(int argc, const char** argv);
 extern void test(int argc, const char** argv);
+extern void bootstrap(int argc, const char** argv);
+extern void pull(int argc, const char** argv);
+extern void status(int argc, const char** argv);
+extern void execute(int argc, const char** argv);
+extern void remove_project(int argc, const char** argv);
+extern void duplicate(int argc, const char** argv);
+extern void query(int argc, const char** argv);
 extern void project(int argc, const char** argv);
+extern void cache(int argc, const char** argv);
+extern void worker(int argc, const char** argv);
 
 static void help(int argc, const char** argv);
 
@@ -26,15 +35,21 @@ static struct cmd_struct commands[] = {
 
         // functions
         { "clone", "", &clone, "ag-clone" },
+        { "pull", "", &pull, "ag-pull" },
+        { "status", "st", &status, "ag-status" },
+        { "exec", "", &execute, "ag-exec" },
         { "component", "comp", &component, "ag-component" },
         { "project", "proj", &project, "ag-project" },
         { "build", "", &build, "ag-script" },
         { "help", "", &help, "ag-help" },
         { "clean", "", &clean, "ag-script" },
         { "test", "", &test, "ag-script" },
-
-        // scripts
-        { "remove", "", NULL, "ag-remove" }
+        { "bootstrap", "", &bootstrap, "ag-bootstrap" },
+        { "cache", "", &cache, "ag-cache" },
+        { "worker", "", &worker, "ag-worker" },
+        { "remove", "", &remove_project, "ag-remove" },
+        { "duplicate", "dup", &duplicate, "ag-duplicate" },
+        { "query", "q", &query, "ag-query" }
     };
 
 static const char* help_topics[] = {
@@ -1,5 +1,6 @@
 
 #include "agnostic.h"
+#include "fsutil.h"
 
 #include <yaml.h>
 
@@ -67,6 +68,9 @@ enum structure_state {
     s_project_docs,
     s_component,
     s_component_build_after,
+    s_component_outputs,
+    s_clone,
+    s_clone_sparse,
 
     __s_length
 };
@@ -90,6 +94,25 @@ struct ag_project* ag_load_default_or_die() {
     return ret;
 }
 
+// Parses duration in seconds, optionally followed by 's', 'm' or 'h' (e.g. "90", "15m"). Returns -1, if invalid.
+static int parse_seconds(const char* s) {
+    char* end = NULL;
+    long ret = strtol(s, &end, 10);
+    if (end == s || 0 > ret) {
+        return -1;
+    }
+    if ('m' == *end) {
+        ret *= 60;
+        ++end;
+    } else if ('h' == *end) {
+        ret *= 60 * 60;
+        ++end;
+    } else if ('s' == *end) {
+        ++end;
+    }
+    return ('\0' == *end && ret <= 0x7fffffff) ? (int)ret : -1;
+}
+
 static int stack_v(struct list* stack) {
     return stack ? *((int*)stack->data) : -1;
 }
@@ -131,9 +154,16 @@ int ag_load(const char* file_name, struct ag_project** project) {
     struct list* build_after_head = NULL;
     struct list* build_after_tail = NULL;
 
+    struct list* outputs_head = NULL;
+    struct list* outputs_tail = NULL;
+
     struct list* docs_head = NULL;
     struct list* docs_tail = NULL;
 
+    // clone options of the project or the component, which are being read
+    struct ag_clone_options* clone = NULL;
+    struct list* sparse_tail = NULL;
+
     struct list* stack = NULL;
     int stack_vals[__s_length];
     for (int i = 0; i < __s_length; ++i) {
@@ -200,6 +230,8 @@ int ag_load(const char* file_name, struct ag_project** project) {
                     component = (struct ag_component*)xcalloc(1, sizeof(struct ag_component));
                     build_after_head = NULL;
                     build_after_tail = NULL;
+                    outputs_head = NULL;
+                    outputs_tail = NULL;
                     list_add(&components_head, &components_tail, component);
                     (*project)->component_count++;
                     debug_print("%s\n", "push component");
@@ -208,6 +240,22 @@ int ag_load(const char* file_name, struct ag_project** project) {
                     stack = list_create(stack_vals + s_component_build_after, stack);
                     debug_print("%s\n", "push component build after");
 
+                } else if (s_component == sval && !strcmp(key, "outputs")) {
+                    stack = list_create(stack_vals + s_component_outputs, stack);
+                    debug_print("%s\n", "push component outputs");
+
+                } else if ((s_project == sval || s_component == sval) && !strcmp(key, "clone")) {
+                    clone = (s_project == sval) ? &(*project)->clone : &component->clone;
+                    stack = list_create(stack_vals + s_clone, stack);
+                    debug_print("%s\n", "push clone");
+
+                } else if (s_clone == sval && !strcmp(key, "sparse")) {
+                    list_free(clone->sparse, &free);
+                    clone->sparse = NULL;
+                    sparse_tail = NULL;
+                    stack = list_create(stack_vals + s_clone_sparse, stack);
+                    debug_print("%s\n", "push clone sparse");
+
                 } else {
                     stack = list_create(stack_vals + s_unknown, stack);
                     debug_print("%s\n", "push unknown");
@@ -220,6 +268,7 @@ int ag_load(const char* file_name, struct ag_project** project) {
                 if (s_component == sval) {
                     if (component) {
                         component->build_after = build_after_head;
+                        component->outputs = outputs_head;
                     }
                 }
                 list_pop(&stack);
@@ -242,6 +291,26 @@ int ag_load(const char* file_name, struct ag_project** project) {
                         } else if (!strcmp(key, "bugs")) {
                             (*project)->bugs = xstrdup((const char*)token.data.scalar.value);
 
+                        } else if (!strcmp(key, "memoryMax")) {
+                            (*project)->memory_max = xstrdup((const char*)token.data.scalar.value);
+
+                        } else if (!strcmp(key, "cpuMax")) {
+                            (*project)->cpu_max = xstrdup((const char*)token.data.scalar.value);
+
+                        } else if (!strcmp(key, "remoteCache")) {
+                            (*project)->remote_cache = xstrdup((const char*)token.data.scalar.value);
+
+                        } else if (!strcmp(key, "timeout") || !strcmp(key, "stallTimeout")) {
+                            int seconds = parse_seconds((const char*)token.data.scalar.value);
+                            if (0 > seconds) {
+                                eof = 1;
+                                ret = INVALID_PROJECT_FILE;
+                            } else if (!strcmp(key, "timeout")) {
+                                (*project)->timeout = seconds;
+                            } else {
+                                (*project)->stall_timeout = seconds;
+                            }
+
                         }
 
                     } else if (s_project_docs == sval) {
@@ -275,6 +344,23 @@ int ag_load(const char* file_name, struct ag_project** project) {
                         } else if (!strcmp(key, "test")) {
                             component->test = xstrdup((const char*)token.data.scalar.value);
 
+                        } else if (!strcmp(key, "memoryMax")) {
+                            component->memory_max = xstrdup((const char*)token.data.scalar.value);
+
+                        } else if (!strcmp(key, "cpuMax")) {
+                            component->cpu_max = xstrdup((const char*)token.data.scalar.value);
+
+                        } else if (!strcmp(key, "timeout") || !strcmp(key, "stallTimeout")) {
+                            int seconds = parse_seconds((const char*)token.data.scalar.value);
+                            if (0 > seconds) {
+                                eof = 1;
+                                ret = INVALID_PROJECT_FILE;
+                            } else if (!strcmp(key, "timeout")) {
+                                component->timeout = seconds;
+                            } else {
+                                component->stall_timeout = seconds;
+                            }
+
                         } else if (!strcmp(key, "disabled")) {
                             component->disabled = (0 == strcmp("true", (const char*)token.data.scalar.value));
 
@@ -283,6 +369,45 @@ int ag_load(const char* file_name, struct ag_project** project) {
                     } else if (s_component_build_after == sval) {
                         list_add(&build_after_head, &build_after_tail, xstrdup((const char*)token.data.scalar.value));
 
+                    } else if (s_component_outputs == sval) {
+                        const char* value = (const char*)token.data.scalar.value;
+                        // outputs are removed before restoring them from the cache, so they must stay in the
+                        // component directory
+                        if (!is_inner_path(value)) {
+                            eof = 1;
+                            ret = INVALID_PROJECT_FILE;
+                        } else {
+                            list_add(&outputs_head, &outputs_tail, xstrdup(value));
+                        }
+
+                    } else if (s_clone == sval) {
+                        const char* value = (const char*)token.data.scalar.value;
+                        if (!strcmp(key, "depth")) {
+                            char* end = NULL;
+                            long depth = strtol(value, &end, 10);
+                            if (end == value || *end || 0 > depth || depth > 0x7fffffff) {
+                                eof = 1;
+                                ret = INVALID_PROJECT_FILE;
+                            }
+                            // 0 means the whole history, which is different from no setting
+                            clone->depth = depth ? (int)depth : -1;
+
+                        } else if (!strcmp(key, "filter")) {
+                            free(clone->filter);
+                            clone->filter = xstrdup(value);
+
+                        } else if (!strcmp(key, "singleBranch")) {
+                            clone->single_branch = !strcmp("true", value) ? 1 : -1;
+
+                        } else if (!strcmp(key, "branch")) {
+                            free(clone->branch);
+                            clone->branch = xstrdup(value);
+
+                        }
+
+                    } else if (s_clone_sparse == sval) {
+                        list_add(&clone->sparse, &sparse_tail, xstrdup((const char*)token.data.scalar.value));
+
                     }
 
                     free(key);
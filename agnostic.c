@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 static const char* error_messages[] = {
     [OK] = "OK",
@@ -24,6 +25,12 @@ const char* ag_error_msg(int code) {
     return error_messages[code];
 }
 
+static void free_clone_options(struct ag_clone_options* o) {
+    free(o->filter);
+    free(o->branch);
+    list_free(o->sparse, &free);
+}
+
 static void ag_free_component(void* data) {
     if (!data) {
         return;
@@ -38,7 +45,11 @@ static void ag_free_component(void* data) {
     free(c->integrate);
     free(c->clean);
     free(c->test);
+    free(c->memory_max);
+    free(c->cpu_max);
     list_free(c->build_after, &free);
+    list_free(c->outputs, &free);
+    free_clone_options(&c->clone);
     free(c);
 }
 
@@ -51,6 +62,10 @@ void ag_free(struct ag_project* p) {
     free(p->bugs);
     free(p->dir);
     free(p->file);
+    free(p->memory_max);
+    free(p->cpu_max);
+    free(p->remote_cache);
+    free_clone_options(&p->clone);
     list_free(p->components, &ag_free_component);
     list_free(p->docs, &free);
     free(p);
@@ -189,6 +204,24 @@ char* ag_component_dir(struct ag_project* project, struct ag_component* componen
     return ret;
 }
 
+char* ag_state_file(struct ag_project* project, const char* file_name) {
+    assert(project);
+    assert(project->dir);
+    assert(file_name);
+
+    char* ret = NULL;
+    if (-1 == asprintf(&ret, "%s/" AG_STATE_DIR "/%s", project->dir, file_name)) {
+        die("Out of memory, asprintf failed");
+    }
+    // create the state directory and all subdirectories of the file
+    for (char* p = ret + strlen(project->dir) + 1; (p = strchr(p, '/')); ++p) {
+        *p = '\0';
+        mkdir(ret, 0755);
+        *p = '/';
+    }
+    return ret;
+}
+
 static int is_component_up_in_branch_guarded(struct ag_project* project, struct ag_component* leaf, const char* name, int count) {
     if (count > project->component_count + 2) {
         // actually, it's a dependency loop
@@ -3,6 +3,15 @@
 
 #include "common.h"
 
+// Options for cloning repositories. Component options override the project ones.
+struct ag_clone_options {
+    int depth;              // number of commits to fetch, -1 to fetch the whole history, 0 if not set
+    char* filter;           // partial clone filter (git), e.g. "blob:none"
+    int single_branch;      // 1 to fetch only the cloned branch, -1 to fetch all branches, 0 if not set
+    char* branch;           // branch to check out
+    struct list* sparse;    // string list, directories for sparse checkout (git), or NULL to check out everything
+};
+
 struct ag_component {
     char* name;
     char* alias;
@@ -13,8 +22,14 @@ struct ag_component {
     char* integrate;
     char* clean;
     char* test;
+    char* memory_max; // cgroup v2 memory.max for scripts, e.g. "2G"
+    char* cpu_max; // cgroup v2 cpu.max for scripts, e.g. "200000 100000"
+    int timeout; // seconds, after which scripts are killed, or 0
+    int stall_timeout; // seconds without output, after which scripts are killed, or 0
     int disabled;
     struct list* build_after; // string list, keeps component names
+    struct list* outputs; // string list, build output paths relative to the component directory
+    struct ag_clone_options clone;
 };
 
 struct ag_project {
@@ -23,6 +38,12 @@ struct ag_project {
     char* bugs;
     char* dir;
     char* file;
+    char* memory_max; // default memory.max for components
+    char* cpu_max; // default cpu.max for components
+    int timeout; // default timeout for components
+    int stall_timeout; // default stall timeout for components
+    struct ag_clone_options clone; // default clone options for components
+    char* remote_cache; // base URL of the remote artifact cache
     int component_count;
     struct list* components; // list of ag_component
     struct list* docs; // list of strings
@@ -69,6 +90,14 @@ struct ag_component* ag_find_component(struct ag_project* project, const char* n
 // Returns the given component directory.
 char* ag_component_dir(struct ag_project* project, struct ag_component* component);
 
+// Name of the directory inside the project directory, where Agnostic keeps its state (logs, stamps, etc).
+#define AG_STATE_DIR ".agnostic"
+
+// Returns path to the given file inside the project state directory. The file name may contain subdirectories.
+// Creates the state directory and the subdirectories, if needed.
+// The returned string should be freed.
+char* ag_state_file(struct ag_project* project, const char* file_name);
+
 // Returns a list of components, which should be built before the given component. 
 // On success, the list always includes the given component as its last item. On failure to resolve dependencies, NULL is returned.
 // Components in the list are sorted appropriately.
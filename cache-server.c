@@ -0,0 +1,323 @@
+// for asprintf() and strptime()
+#define _GNU_SOURCE
+
+#include "cache-server.h"
+#include "common.h"
+#include "fsutil.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_HEADER_SIZE 8192
+
+struct request {
+    char method[16];
+    char path[1024];
+    long long content_length;   // -1, if not specified
+    int chunked;
+    int expect_continue;
+    char* body;                 // part of the body, which was read together with the header
+    size_t body_len;
+    char if_none_match[128];    // empty, if not specified
+    char if_modified_since[64]; // empty, if not specified
+};
+
+static int write_all(int fd, const char* data, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, data, len);
+        if (0 > n) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Sends the response header. 'extra' are additional header lines, each ending with "\r\n".
+static void respond_with(int fd, int code, const char* reason, long long content_length, const char* extra) {
+    char header[512];
+    int len = snprintf(header, sizeof(header),
+        "HTTP/1.1 %d %s\r\nContent-Length: %lld\r\n%sConnection: close\r\n\r\n", code, reason, content_length,
+        extra);
+    write_all(fd, header, len);
+}
+
+static void respond(int fd, int code, const char* reason, long long content_length) {
+    respond_with(fd, code, reason, content_length, "");
+}
+
+static void log_request(const struct request* r, int code) {
+    time_t t = time(NULL);
+    char when[32];
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&t));
+    printf("%s %s %s %d\n", when, r->method, r->path, code);
+    fflush(stdout);
+}
+
+// Reads and parses the request header. Returns 0 on success.
+static int read_request(int fd, char* buf, struct request* r) {
+    size_t len = 0;
+    char* end = NULL;
+    while (!end) {
+        if (MAX_HEADER_SIZE - 1 == len) {
+            return -1;
+        }
+        ssize_t n = read(fd, buf + len, MAX_HEADER_SIZE - 1 - len);
+        if (0 > n && EINTR == errno) {
+            continue;
+        }
+        if (0 >= n) {
+            return -1;
+        }
+        len += n;
+        buf[len] = '\0';
+        end = strstr(buf, "\r\n\r\n");
+    }
+    *end = '\0';
+    r->body = end + 4;
+    r->body_len = buf + len - r->body;
+    r->content_length = -1;
+
+    char* save = NULL;
+    char* line = strtok_r(buf, "\r\n", &save);
+    if (!line || 2 != sscanf(line, "%15s %1023s", r->method, r->path)) {
+        return -1;
+    }
+    while ((line = strtok_r(NULL, "\r\n", &save))) {
+        char* value = strchr(line, ':');
+        if (!value) {
+            continue;
+        }
+        *value++ = '\0';
+        value += strspn(value, " \t");
+        if (!strcasecmp("Content-Length", line)) {
+            r->content_length = atoll(value);
+        } else if (!strcasecmp("Transfer-Encoding", line)) {
+            // any transfer coding ends with 'chunked'
+            r->chunked = 1;
+        } else if (!strcasecmp("Expect", line)) {
+            r->expect_continue = !strcasecmp("100-continue", value);
+        } else if (!strcasecmp("If-None-Match", line)) {
+            snprintf(r->if_none_match, sizeof(r->if_none_match), "%s", value);
+        } else if (!strcasecmp("If-Modified-Since", line)) {
+            snprintf(r->if_modified_since, sizeof(r->if_modified_since), "%s", value);
+        }
+    }
+    return 0;
+}
+
+// Returns 1, if the path may be served: it's absolute, has no empty, '.' or '..' segments, and has no
+// characters, except letters, digits, '-', '_', '.' and '/'.
+static int valid_path(const char* path) {
+    if ('/' != path[0] || !path[1]) {
+        return 0;
+    }
+    for (const char* p = path; *p; ++p) {
+        if ('/' == *p && ('/' == p[1] || '\0' == p[1] || ('.' == p[1] && ('/' == p[2] || '\0' == p[2] || '.' == p[2])))) {
+            return 0;
+        }
+        if (!strchr("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-_./", *p)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Returns 1, if the client's copy is up to date according to the conditional request headers. If-Modified-Since is
+// only used without If-None-Match, as RFC 7232 requires.
+static int not_modified(const struct request* r, const char* etag, time_t mtime) {
+    if (r->if_none_match[0]) {
+        return !strcmp("*", r->if_none_match) || strstr(r->if_none_match, etag);
+    }
+    if (r->if_modified_since[0]) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        const char* end = strptime(r->if_modified_since, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        return end && !*end && mtime <= timegm(&tm);
+    }
+    return 0;
+}
+
+static int serve_get(int fd, const struct request* r, const char* file_name) {
+    int file_fd = open(file_name, O_RDONLY);
+    struct stat st;
+    if (0 > file_fd || fstat(file_fd, &st) || !S_ISREG(st.st_mode)) {
+        if (0 <= file_fd) {
+            close(file_fd);
+        }
+        respond(fd, 404, "Not Found", 0);
+        return 404;
+    }
+    // files are replaced, rather than modified, so size and modification time identify the content
+    char etag[64];
+    snprintf(etag, sizeof(etag), "\"%llx-%llx\"", (long long)st.st_size,
+        (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec);
+    char last_modified[64];
+    strftime(last_modified, sizeof(last_modified), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&st.st_mtime));
+    char validators[160];
+    snprintf(validators, sizeof(validators), "ETag: %s\r\nLast-Modified: %s\r\n", etag, last_modified);
+
+    if (not_modified(r, etag, st.st_mtime)) {
+        close(file_fd);
+        respond_with(fd, 304, "Not Modified", 0, validators);
+        return 304;
+    }
+    respond_with(fd, 200, "OK", (long long)st.st_size, validators);
+    if (!strcmp("GET", r->method)) {
+        char buf[65536];
+        ssize_t n = 0;
+        while (0 < (n = read(file_fd, buf, sizeof(buf))) && !write_all(fd, buf, n)) {
+        }
+    }
+    close(file_fd);
+    return 200;
+}
+
+static int serve_put(int fd, struct request* r, const char* file_name) {
+    if (r->chunked || 0 > r->content_length) {
+        respond(fd, 411, "Length Required", 0);
+        return 411;
+    }
+    char* parent = parent_dir((char*)file_name);
+    char* tmp = NULL;
+    if (-1 == asprintf(&tmp, "%s.%d.tmp", file_name, (int)getpid())) {
+        die("Out of memory, asprintf failed");
+    }
+    int file_fd = make_dirs(parent, 0755) ? -1 : open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    free(parent);
+    if (0 > file_fd) {
+        free(tmp);
+        respond(fd, 500, "Internal Server Error", 0);
+        return 500;
+    }
+    if (r->expect_continue) {
+        const char* cont = "HTTP/1.1 100 Continue\r\n\r\n";
+        write_all(fd, cont, strlen(cont));
+    }
+
+    long long left = r->content_length;
+    size_t first = (size_t)left < r->body_len ? (size_t)left : r->body_len;
+    int failed = write_all(file_fd, r->body, first);
+    left -= first;
+    char buf[65536];
+    while (!failed && left) {
+        ssize_t n = read(fd, buf, (size_t)left < sizeof(buf) ? (size_t)left : sizeof(buf));
+        if (0 > n && EINTR == errno) {
+            continue;
+        }
+        failed = 0 >= n || write_all(file_fd, buf, n);
+        left -= 0 < n ? n : 0;
+    }
+    failed = close(file_fd) || failed;
+    if (failed || rename(tmp, file_name)) {
+        remove(tmp);
+        free(tmp);
+        respond(fd, 500, "Internal Server Error", 0);
+        return 500;
+    }
+    free(tmp);
+    respond(fd, 201, "Created", 0);
+    return 201;
+}
+
+static void serve_connection(int fd, const char* dir) {
+    char* buf = (char*)xmalloc(MAX_HEADER_SIZE);
+    struct request r;
+    memset(&r, 0, sizeof(r));
+    int code = 400;
+    if (read_request(fd, buf, &r)) {
+        respond(fd, 400, "Bad Request", 0);
+        free(buf);
+        return;
+    }
+    if (!valid_path(r.path)) {
+        respond(fd, 400, "Bad Request", 0);
+    } else {
+        char* file_name = NULL;
+        if (-1 == asprintf(&file_name, "%s%s", dir, r.path)) {
+            die("Out of memory, asprintf failed");
+        }
+        if (!strcmp("GET", r.method) || !strcmp("HEAD", r.method)) {
+            code = serve_get(fd, &r, file_name);
+        } else if (!strcmp("PUT", r.method)) {
+            code = serve_put(fd, &r, file_name);
+        } else {
+            code = 405;
+            respond(fd, 405, "Method Not Allowed", 0);
+        }
+        free(file_name);
+    }
+    log_request(&r, code);
+    free(buf);
+}
+
+int cache_serve(const char* dir, const char* address, int port) {
+    if (make_dirs(dir, 0755)) {
+        perror(dir);
+        return 1;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (1 != inet_pton(AF_INET, address, &addr.sin_addr)) {
+        fprintf(stderr, "Invalid address: %s\n", address);
+        return 1;
+    }
+    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    if (0 > server_fd
+            || setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on))
+            || bind(server_fd, (struct sockaddr*)&addr, sizeof(addr))
+            || listen(server_fd, 64)) {
+        perror("Unable to listen");
+        if (0 <= server_fd) {
+            close(server_fd);
+        }
+        return 1;
+    }
+    // connection handlers are never waited for
+    signal(SIGCHLD, SIG_IGN);
+    // a client may disconnect in the middle of a response
+    signal(SIGPIPE, SIG_IGN);
+    printf("Serving %s on http://%s:%d\n", dir, address, port);
+    fflush(stdout);
+
+    while (1) {
+        int fd = accept(server_fd, NULL, NULL);
+        if (0 > fd) {
+            if (EINTR == errno || ECONNABORTED == errno) {
+                continue;
+            }
+            perror("accept");
+            close(server_fd);
+            return 1;
+        }
+        pid_t pid = xfork();
+        if (0 == pid) {
+            close(server_fd);
+            serve_connection(fd, dir);
+            close(fd);
+            xexit(0);
+        }
+        if (-1 == pid) {
+            perror("fork");
+        }
+        close(fd);
+    }
+}
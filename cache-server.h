@@ -0,0 +1,14 @@
+#ifndef CACHE_SERVER_H
+#define CACHE_SERVER_H
+
+// Reference remote cache server. Serves files of the given directory via HTTP: GET and HEAD return a file (with ETag
+// and Last-Modified, honouring If-None-Match and If-Modified-Since), PUT stores a file (atomically, so that readers
+// never see partial entries). Anything else is rejected.
+// Each connection is handled by a separate process and serves a single request.
+
+#define CACHE_SERVER_DEFAULT_PORT 8077
+
+// Serves the directory (absolute path) on the given IPv4 address and port. Returns only on failure, with non-zero value.
+int cache_serve(const char* dir, const char* address, int port);
+
+#endif /* CACHE_SERVER_H */
@@ -0,0 +1,710 @@
+// for asprintf()
+#define _GNU_SOURCE
+
+#include "cache.h"
+#include "digest.h"
+#include "fsutil.h"
+#include "stamp.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define CACHE_VERSION "agnostic-artifact-1"
+#define TEST_CACHE_VERSION "agnostic-test-1"
+
+// Seconds to wait for connection to the remote cache.
+#define REMOTE_CONNECT_TIMEOUT "5"
+
+// Uploads a local entry ($2) to the remote cache ($1), unless it's already there. $3 is a prefix for temp files.
+#define UPLOAD_SCRIPT \
+    "url=\"$1\"; entry=\"$2\"; archive=\"$3.$$.tar\"\n" \
+    "curl -sfI --connect-timeout " REMOTE_CONNECT_TIMEOUT " \"$url\" && exit 0\n" \
+    "tar -cf \"$archive\" -C \"$entry\" . && curl -sf --connect-timeout " REMOTE_CONNECT_TIMEOUT " -T \"$archive\" \"$url\"\n" \
+    "ret=$?\n" \
+    "rm -f \"$archive\"\n" \
+    "exit $ret\n"
+
+char* cache_dir() {
+    const char* dir = getenv("AG_CACHE_DIR");
+    if (empty(dir)) {
+        return user_cache_dir("artifacts");
+    }
+    if (make_dirs(dir, 0755)) {
+        perror(dir);
+        die("Unable to create cache directory");
+    }
+    return xstrdup(dir);
+}
+
+long long cache_size_limit() {
+    const char* s = getenv("AG_CACHE_SIZE");
+    if (empty(s)) {
+        return CACHE_DEFAULT_SIZE;
+    }
+    char* end = NULL;
+    double v = strtod(s, &end);
+    switch (*end) {
+    case 'k': case 'K': v *= 1024; break;
+    case 'm': case 'M': v *= 1024 * 1024; break;
+    case 'g': case 'G': v *= 1024 * 1024 * 1024; break;
+    case 't': case 'T': v *= 1024.0 * 1024 * 1024 * 1024; break;
+    case '\0': break;
+    default:
+        die("Invalid cache size: %s", s);
+    }
+    return (long long)v;
+}
+
+static char* path_join(const char* a, const char* b) {
+    char* ret = NULL;
+    if (-1 == asprintf(&ret, "%s/%s", a, b)) {
+        die("Out of memory, asprintf failed");
+    }
+    return ret;
+}
+
+static char* entry_dir(const char* root, const char* key) {
+    char* ret = NULL;
+    if (-1 == asprintf(&ret, "%s/%.2s/%s", root, key, key)) {
+        die("Out of memory, asprintf failed");
+    }
+    return ret;
+}
+
+static char* outputs_record_file(struct ag_project* project, struct ag_component* c) {
+    char* name = path_join("outputs", c->name);
+    char* ret = ag_state_file(project, name);
+    free(name);
+    return ret;
+}
+
+// Returns digest of the upstream component's outputs, or NULL, if it's unknown.
+static char* upstream_outputs(struct ag_project* project, struct ag_component* up) {
+    if (up->outputs) {
+        char* file_name = outputs_record_file(project, up);
+        char* ret = read_file(file_name);
+        free(file_name);
+        return ret;
+    }
+    // outputs are not declared, so the best we can do is to rely on the upstream stamp
+    char* stamp = stamp_read(project, up);
+    if (!stamp) {
+        return NULL;
+    }
+    char hex[DIGEST_HEX_SIZE];
+    digest_str_hex(stamp, hex);
+    free(stamp);
+    return xstrdup(hex);
+}
+
+char* cache_key(struct ag_project* project, struct ag_component* c, const char* source_state) {
+    assert(project);
+    assert(c);
+
+    if (!c->outputs || !source_state) {
+        return NULL;
+    }
+    struct digest d;
+    digest_init(&d);
+    digest_update_str(&d, CACHE_VERSION);
+    digest_update_str(&d, source_state);
+    digest_update_str(&d, c->build);
+    for (struct list* l = c->outputs; l; l = l->next) {
+        assert(is_inner_path((char*)l->data));
+        digest_update_str(&d, (char*)l->data);
+    }
+    for (struct list* l = c->build_after; l; l = l->next) {
+        struct ag_component* up = ag_find_component(project, (char*)l->data);
+        char* outputs = up ? upstream_outputs(project, up) : NULL;
+        if (!outputs) {
+            return NULL;
+        }
+        digest_update_str(&d, up->name);
+        digest_update_str(&d, outputs);
+        free(outputs);
+    }
+    char hex[DIGEST_HEX_SIZE];
+    digest_final_hex(&d, hex);
+    return xstrdup(hex);
+}
+
+static int compare_names(const struct dirent** a, const struct dirent** b) {
+    return strcmp((*a)->d_name, (*b)->d_name);
+}
+
+// Adds names, types and contents of everything in the tree to the digest, in a stable order.
+static void digest_tree(struct digest* d, const char* path) {
+    struct stat st;
+    if (lstat(path, &st)) {
+        digest_update_str(d, "-");
+        return;
+    }
+    if (S_ISLNK(st.st_mode)) {
+        char target[4096];
+        ssize_t n = readlink(path, target, sizeof(target) - 1);
+        target[0 < n ? n : 0] = '\0';
+        digest_update_str(d, "l");
+        digest_update_str(d, target);
+    } else if (S_ISREG(st.st_mode)) {
+        digest_update_str(d, (st.st_mode & S_IXUSR) ? "x" : "f");
+        digest_update_file(d, path);
+    } else if (S_ISDIR(st.st_mode)) {
+        digest_update_str(d, "d");
+        struct dirent** entries = NULL;
+        int n = scandir(path, &entries, NULL, &compare_names);
+        for (int i = 0; i < n; ++i) {
+            if (strcmp(".", entries[i]->d_name) && strcmp("..", entries[i]->d_name)) {
+                char* p = path_join(path, entries[i]->d_name);
+                digest_update_str(d, entries[i]->d_name);
+                digest_tree(d, p);
+                free(p);
+            }
+            free(entries[i]);
+        }
+        free(entries);
+        digest_update_str(d, "/");
+    }
+}
+
+#define STATS_FORMAT "hits %lld\nmisses %lld\nstores %lld\nevictions %lld\nremote-hits %lld\nuploads %lld\n"
+
+// Adds the given deltas to the statistics file.
+static void update_stats(const struct cache_stats* delta) {
+    char* root = cache_dir();
+    char* file_name = path_join(root, "stats");
+    free(root);
+    int fd = open(file_name, O_RDWR | O_CREAT, 0644);
+    free(file_name);
+    if (0 > fd) {
+        return;
+    }
+    flock(fd, LOCK_EX);
+    char buf[512] = { 0 };
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    buf[0 < n ? n : 0] = '\0';
+    struct cache_stats st = { 0 };
+    sscanf(buf, STATS_FORMAT, &st.hits, &st.misses, &st.stores, &st.evictions, &st.remote_hits, &st.uploads);
+    int len = snprintf(buf, sizeof(buf), STATS_FORMAT, st.hits + delta->hits, st.misses + delta->misses,
+        st.stores + delta->stores, st.evictions + delta->evictions, st.remote_hits + delta->remote_hits,
+        st.uploads + delta->uploads);
+    if (0 == lseek(fd, 0, SEEK_SET) && len == write(fd, buf, len)) {
+        ftruncate(fd, len);
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+static void record_outputs(struct ag_project* project, struct ag_component* c, const char* digest) {
+    char* file_name = outputs_record_file(project, c);
+    write_file_atomic(file_name, digest);
+    free(file_name);
+}
+
+void cache_forget_outputs(struct ag_project* project, struct ag_component* c) {
+    assert(project);
+    assert(c);
+
+    char* file_name = outputs_record_file(project, c);
+    remove(file_name);
+    free(file_name);
+}
+
+// Returns URL of the entry in the remote cache, which should be freed, or NULL, if there's no remote cache.
+static char* remote_entry_url(struct ag_project* project, const char* key) {
+    const char* base = getenv("AG_REMOTE_CACHE");
+    if (empty(base)) {
+        base = project->remote_cache;
+    }
+    if (empty(base)) {
+        return NULL;
+    }
+    size_t len = strlen(base);
+    while (len && '/' == base[len - 1]) {
+        --len;
+    }
+    char* ret = NULL;
+    if (-1 == asprintf(&ret, "%.*s/%.2s/%s.tar", (int)len, base, key, key)) {
+        die("Out of memory, asprintf failed");
+    }
+    return ret;
+}
+
+// Redirects standard streams to /dev/null.
+static void redirect_to_null() {
+    int null_fd = open("/dev/null", O_RDWR);
+    if (0 <= null_fd) {
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        close(null_fd);
+    }
+}
+
+// Runs the program with the given NULL-terminated arguments, discarding its output.
+// Returns exit code of the program, or -1, if it couldn't be run or was killed.
+static int run_quiet(const char* const* argv) {
+    pid_t pid = xfork();
+    if (0 == pid) {
+        redirect_to_null();
+        execvp(argv[0], (char* const*)argv);
+        xexit(127);
+    }
+    if (-1 == pid) {
+        return -1;
+    }
+    int status = 0;
+    while (0 > waitpid(pid, &status, 0)) {
+        if (EINTR != errno) {
+            return -1;
+        }
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Downloads the entry from the remote cache into the local cache. Returns 0 on success.
+static int remote_fetch(struct ag_project* project, const char* root, const char* key) {
+    char* url = remote_entry_url(project, key);
+    if (!url) {
+        return -1;
+    }
+    char* tmp = NULL;
+    char* archive = NULL;
+    if (-1 == asprintf(&tmp, "%s/tmp/%s.%d.remote", root, key, (int)getpid())
+            || -1 == asprintf(&archive, "%s.tar", tmp)) {
+        die("Out of memory, asprintf failed");
+    }
+    const char* curl[] = { "curl", "-sf", "--connect-timeout", REMOTE_CONNECT_TIMEOUT, "-o", archive, url, NULL };
+    const char* tar[] = { "tar", "-xf", archive, "-C", tmp, NULL };
+    remove_tree(tmp);
+    int ret = make_dirs(tmp, 0755) || run_quiet(curl) || run_quiet(tar);
+    if (!ret) {
+        char* outputs_file = path_join(tmp, "outputs");
+        char* entry = entry_dir(root, key);
+        char* parent = parent_dir(entry);
+        ret = !path_exists(outputs_file) || make_dirs(parent, 0755);
+        if (!ret && rename(tmp, entry)) {
+            // fine, if someone else has stored the same entry meanwhile
+            ret = !path_exists(entry);
+        }
+        free(parent);
+        free(entry);
+        free(outputs_file);
+    }
+    remove(archive);
+    remove_tree(tmp);
+    free(archive);
+    free(tmp);
+    free(url);
+    return ret ? -1 : 0;
+}
+
+// Starts uploading the local entry to the remote cache in a detached process, so that the build never waits for it.
+// Returns 0, if the upload has been started.
+static int remote_upload(struct ag_project* project, const char* root, const char* key) {
+    if (!empty(getenv("AG_REMOTE_CACHE_READONLY"))) {
+        return -1;
+    }
+    char* url = remote_entry_url(project, key);
+    if (!url) {
+        return -1;
+    }
+    char* entry = entry_dir(root, key);
+    char* tmp = NULL;
+    if (-1 == asprintf(&tmp, "%s/tmp/%s.upload", root, key)) {
+        die("Out of memory, asprintf failed");
+    }
+    pid_t pid = xfork();
+    if (0 == pid) {
+        // the intermediate child exits at once, so the uploader is reparented to init and nobody waits for it
+        setsid();
+        if (0 != xfork()) {
+            xexit(0);
+        }
+        long max_fd = sysconf(_SC_OPEN_MAX);
+        for (int fd = STDERR_FILENO + 1; fd < (0 < max_fd && max_fd < 65536 ? max_fd : 65536); ++fd) {
+            // don't keep pipes of running scripts open
+            close(fd);
+        }
+        redirect_to_null();
+        execl("/bin/sh", "sh", "-c", UPLOAD_SCRIPT, "sh", url, entry, tmp, (char*)NULL);
+        xexit(127);
+    }
+    int status = -1;
+    if (-1 != pid) {
+        while (0 > waitpid(pid, &status, 0) && EINTR == errno) {
+        }
+    }
+    free(tmp);
+    free(entry);
+    free(url);
+    return (-1 != pid && WIFEXITED(status) && 0 == WEXITSTATUS(status)) ? 0 : -1;
+}
+
+int cache_restore(struct ag_project* project, struct ag_component* c, const char* key) {
+    assert(project);
+    assert(c);
+    assert(key);
+
+    char* root = cache_dir();
+    char* entry = entry_dir(root, key);
+    char* files = path_join(entry, "files");
+    char* outputs_file = path_join(entry, "outputs");
+    char* outputs = read_file(outputs_file);
+    int remote = 0;
+    if (!outputs && !remote_fetch(project, root, key)) {
+        outputs = read_file(outputs_file);
+        remote = 1;
+    }
+    free(outputs_file);
+    free(root);
+
+    int ret = -1;
+    if (outputs) {
+        const char* mode = getenv("AG_CACHE_RESTORE");
+        int flags = COPY_REFLINK | ((mode && !strcmp("hardlink", mode)) ? COPY_HARDLINK : 0);
+        char* dir = ag_component_dir(project, c);
+        ret = 0;
+        for (struct list* l = c->outputs; l && !ret; l = l->next) {
+            assert(is_inner_path((char*)l->data));
+            char* dst = path_join(dir, (char*)l->data);
+            char* src = path_join(files, (char*)l->data);
+            remove_tree(dst);
+            if (path_exists(src)) {
+                char* parent = parent_dir(dst);
+                ret = make_dirs(parent, 0755) || copy_tree(src, dst, flags);
+                free(parent);
+            }
+            free(src);
+            free(dst);
+        }
+        free(dir);
+        if (ret) {
+            // the entry may have been evicted meanwhile
+            fprintf(stderr, WARN_COLOR "Failed to restore outputs of %s from cache" COLOR_RESET "\n", c->name);
+            cache_forget_outputs(project, c);
+        } else {
+            record_outputs(project, c, outputs);
+            utimes(entry, NULL); // mark as recently used
+        }
+        free(outputs);
+    }
+    struct cache_stats delta = { 0 };
+    delta.hits = ret ? 0 : 1;
+    delta.misses = ret ? 1 : 0;
+    delta.remote_hits = (ret || !remote) ? 0 : 1;
+    update_stats(&delta);
+    free(files);
+    free(entry);
+    return ret;
+}
+
+int cache_store(struct ag_project* project, struct ag_component* c, const char* key) {
+    assert(project);
+    assert(c);
+    assert(key);
+
+    char* root = cache_dir();
+    char* tmp = NULL;
+    if (-1 == asprintf(&tmp, "%s/tmp/%s.%d", root, key, (int)getpid())) {
+        die("Out of memory, asprintf failed");
+    }
+    char* files = path_join(tmp, "files");
+    char* dir = ag_component_dir(project, c);
+    remove_tree(tmp);
+    int ret = make_dirs(files, 0755);
+
+    struct digest d;
+    digest_init(&d);
+    for (struct list* l = c->outputs; l && !ret; l = l->next) {
+        char* src = path_join(dir, (char*)l->data);
+        char* dst = path_join(files, (char*)l->data);
+        if (path_exists(src)) {
+            char* parent = parent_dir(dst);
+            ret = make_dirs(parent, 0755) || copy_tree(src, dst, COPY_REFLINK);
+            free(parent);
+        }
+        digest_update_str(&d, (char*)l->data);
+        digest_tree(&d, dst);
+        free(src);
+        free(dst);
+    }
+    char hex[DIGEST_HEX_SIZE];
+    digest_final_hex(&d, hex);
+
+    if (!ret) {
+        char* outputs_file = path_join(tmp, "outputs");
+        char* size_file = path_join(tmp, "size");
+        char size[32];
+        snprintf(size, sizeof(size), "%lld\n", tree_size(files));
+        ret = write_file_atomic(outputs_file, hex) || write_file_atomic(size_file, size);
+        free(outputs_file);
+        free(size_file);
+    }
+    if (!ret) {
+        char* entry = entry_dir(root, key);
+        char* parent = parent_dir(entry);
+        make_dirs(parent, 0755);
+        if (rename(tmp, entry)) {
+            // someone else has stored the same entry meanwhile, which is fine
+            remove_tree(tmp);
+        }
+        free(parent);
+        free(entry);
+        record_outputs(project, c, hex);
+        struct cache_stats delta = { 0 };
+        delta.stores = 1;
+        delta.uploads = remote_upload(project, root, key) ? 0 : 1;
+        update_stats(&delta);
+    } else {
+        remove_tree(tmp);
+        cache_forget_outputs(project, c);
+    }
+
+    free(dir);
+    free(files);
+    free(tmp);
+    free(root);
+    if (!ret) {
+        cache_evict(cache_size_limit());
+    }
+    return ret;
+}
+
+// Returns digest of the state the component has been built in: its recorded stamp, or, if it has no build
+// script, its sources. Returns NULL, if it's unknown.
+static char* build_state(struct ag_project* project, struct ag_component* c) {
+    char* state = empty(c->build) ? stamp_source_state(project, c) : stamp_read(project, c);
+    if (!state) {
+        return NULL;
+    }
+    char hex[DIGEST_HEX_SIZE];
+    digest_str_hex(state, hex);
+    free(state);
+    return xstrdup(hex);
+}
+
+char* cache_test_key(struct ag_project* project, struct ag_component* c, const char* source_state) {
+    assert(project);
+    assert(c);
+
+    if (!source_state || empty(c->test)) {
+        return NULL;
+    }
+    char* own = build_state(project, c);
+    if (!own) {
+        return NULL;
+    }
+    struct digest d;
+    digest_init(&d);
+    digest_update_str(&d, TEST_CACHE_VERSION);
+    digest_update_str(&d, source_state);
+    digest_update_str(&d, c->test);
+    digest_update_str(&d, own);
+    free(own);
+    for (struct list* l = c->build_after; l; l = l->next) {
+        struct ag_component* up = ag_find_component(project, (char*)l->data);
+        char* state = up ? build_state(project, up) : NULL;
+        if (!state) {
+            return NULL;
+        }
+        digest_update_str(&d, up->name);
+        digest_update_str(&d, state);
+        free(state);
+    }
+    char hex[DIGEST_HEX_SIZE];
+    digest_final_hex(&d, hex);
+    return xstrdup(hex);
+}
+
+int cache_test_restore(const char* key, struct buffer* log) {
+    assert(key);
+    assert(log);
+
+    char* root = cache_dir();
+    char* entry = entry_dir(root, key);
+    char* log_file = path_join(entry, "log");
+    // test output may contain null bytes, so it's read as is
+    int ret = read_file_buffer(log_file, log);
+    if (!ret) {
+        utimes(entry, NULL); // mark as recently used
+    }
+    struct cache_stats delta = { 0 };
+    delta.hits = ret ? 0 : 1;
+    delta.misses = ret ? 1 : 0;
+    update_stats(&delta);
+    free(log_file);
+    free(entry);
+    free(root);
+    return ret;
+}
+
+int cache_test_store(const char* key, const struct buffer* log) {
+    assert(key);
+    assert(log);
+
+    char* root = cache_dir();
+    char* tmp = NULL;
+    if (-1 == asprintf(&tmp, "%s/tmp/%s.%d", root, key, (int)getpid())) {
+        die("Out of memory, asprintf failed");
+    }
+    char* log_file = path_join(tmp, "log");
+    char* size_file = path_join(tmp, "size");
+    char size[32];
+    snprintf(size, sizeof(size), "%zu\n", log->len);
+    remove_tree(tmp);
+    int ret = make_dirs(tmp, 0755) || write_data_atomic(log_file, log->data, log->len)
+        || write_file_atomic(size_file, size);
+    if (!ret) {
+        char* entry = entry_dir(root, key);
+        char* parent = parent_dir(entry);
+        make_dirs(parent, 0755);
+        if (rename(tmp, entry)) {
+            remove_tree(tmp);
+        }
+        free(parent);
+        free(entry);
+        struct cache_stats delta = { 0 };
+        delta.stores = 1;
+        update_stats(&delta);
+    } else {
+        remove_tree(tmp);
+    }
+    free(size_file);
+    free(log_file);
+    free(tmp);
+    free(root);
+    if (!ret) {
+        cache_evict(cache_size_limit());
+    }
+    return ret;
+}
+
+struct cache_entry {
+    char* path;
+    long long size;
+    time_t used;
+};
+
+static int compare_entries(const void* a, const void* b) {
+    const struct cache_entry* x = (const struct cache_entry*)a;
+    const struct cache_entry* y = (const struct cache_entry*)b;
+    return (x->used > y->used) - (x->used < y->used);
+}
+
+// Lists all entries of the cache. Returns their number, the array should be freed with free_entries().
+static int list_entries(const char* root, struct cache_entry** entries, long long* total) {
+    int count = 0;
+    int cap = 0;
+    *entries = NULL;
+    *total = 0;
+    DIR* top = opendir(root);
+    if (!top) {
+        return 0;
+    }
+    struct dirent* t = NULL;
+    while ((t = readdir(top))) {
+        if (2 != strlen(t->d_name) || '.' == t->d_name[0]) {
+            continue;
+        }
+        char* shard = path_join(root, t->d_name);
+        DIR* dir = opendir(shard);
+        struct dirent* e = NULL;
+        while (dir && (e = readdir(dir))) {
+            if ('.' == e->d_name[0]) {
+                continue;
+            }
+            char* path = path_join(shard, e->d_name);
+            char* size_file = path_join(path, "size");
+            char* size = read_file(size_file);
+            struct stat st;
+            if (stat(path, &st)) {
+                st.st_mtime = 0;
+            }
+            if (count == cap) {
+                cap = cap ? 2 * cap : 64;
+                *entries = (struct cache_entry*)xrealloc(*entries, cap * sizeof(struct cache_entry));
+            }
+            (*entries)[count].path = path;
+            (*entries)[count].size = size ? atoll(size) : tree_size(path);
+            (*entries)[count].used = st.st_mtime;
+            *total += (*entries)[count].size;
+            ++count;
+            free(size);
+            free(size_file);
+        }
+        if (dir) {
+            closedir(dir);
+        }
+        free(shard);
+    }
+    closedir(top);
+    return count;
+}
+
+static void free_entries(struct cache_entry* entries, int count) {
+    for (int i = 0; i < count; ++i) {
+        free(entries[i].path);
+    }
+    free(entries);
+}
+
+int cache_evict(long long limit) {
+    char* root = cache_dir();
+    struct cache_entry* entries = NULL;
+    long long total = 0;
+    int count = list_entries(root, &entries, &total);
+    int evicted = 0;
+    if (total > limit) {
+        qsort(entries, count, sizeof(struct cache_entry), &compare_entries);
+        for (int i = 0; i < count && total > limit; ++i) {
+            if (!remove_tree(entries[i].path)) {
+                total -= entries[i].size;
+                ++evicted;
+            }
+        }
+        struct cache_stats delta = { 0 };
+        delta.evictions = evicted;
+        update_stats(&delta);
+    }
+    free_entries(entries, count);
+    free(root);
+    return evicted;
+}
+
+int cache_read_stats(struct cache_stats* stats) {
+    assert(stats);
+
+    memset(stats, 0, sizeof(*stats));
+    char* root = cache_dir();
+    char* file_name = path_join(root, "stats");
+    char* content = read_file(file_name);
+    if (content) {
+        sscanf(content, STATS_FORMAT, &stats->hits, &stats->misses, &stats->stores, &stats->evictions,
+            &stats->remote_hits, &stats->uploads);
+        free(content);
+    }
+    struct cache_entry* entries = NULL;
+    stats->entries = list_entries(root, &entries, &stats->size);
+    free_entries(entries, (int)stats->entries);
+    free(file_name);
+    free(root);
+    return 0;
+}
+
+void cache_reset_stats() {
+    char* root = cache_dir();
+    char* file_name = path_join(root, "stats");
+    remove(file_name);
+    free(file_name);
+    free(root);
+}
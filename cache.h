@@ -0,0 +1,85 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "agnostic.h"
+
+// Local content-addressed artifact cache.
+//
+// Outputs of a component build (the 'outputs' paths of the component) are stored in the cache under a key, which is
+// a digest of the component's sources (VCS revision and uncommitted changes), its build script, its output paths,
+// and output digests of the components it's built after. If the key is found in the cache, outputs are restored
+// instead of running the build script.
+//
+// The cache is kept in $AG_CACHE_DIR, or in ~/.cache/agnostic/artifacts (respecting $XDG_CACHE_HOME). Its size is
+// bounded by $AG_CACHE_SIZE (e.g. "10G", default is 5G); least recently used entries are evicted first.
+// Restored files are reflinked, where possible, and copied otherwise. If $AG_CACHE_RESTORE is "hardlink",
+// restored files are hardlinked to the cache, which is cheaper, but the restored files must never be modified in place.
+//
+// Passing test results are cached as well. A test result is keyed by the component's sources, its test script, and
+// the build state (stamps) of the component and the components it's built after. Its entry keeps the test output,
+// which is replayed instead of running the test script again.
+//
+// A remote cache may be shared between machines. Its base URL is taken from $AG_REMOTE_CACHE, or from the
+// 'remoteCache' setting of the project. Entries are tar archives of local entries, available via HTTP GET and
+// stored via HTTP PUT at <base URL>/<first two key characters>/<key>.tar. The remote cache is consulted on local
+// misses, and entries are uploaded after local stores by detached processes, unless $AG_REMOTE_CACHE_READONLY is set.
+
+#define CACHE_DEFAULT_SIZE (5LL * 1024 * 1024 * 1024)
+
+struct cache_stats {
+    long long hits;
+    long long misses;
+    long long stores;
+    long long evictions;
+    long long remote_hits;  // hits, which were downloaded from the remote cache
+    long long uploads;      // started uploads to the remote cache
+    long long entries;      // filled by cache_read_stats() only
+    long long size;         // filled by cache_read_stats() only
+};
+
+// Returns the cache directory, which should be freed. Creates it, if needed.
+char* cache_dir();
+
+// Returns the cache size limit in bytes.
+long long cache_size_limit();
+
+// Returns the cache key of the component, which should be freed, or NULL, if the component can't be cached
+// (it has no outputs, is not under version control, or outputs of some of its upstream components are unknown).
+// 'source_state' is the result of stamp_source_state().
+char* cache_key(struct ag_project* project, struct ag_component* c, const char* source_state);
+
+// Restores outputs of the component from the cache entry with the given key. If there's no such entry locally,
+// downloads it from the remote cache, if any. Returns 0 on success, or -1, if there's no such entry. On success, records the output digest of the component.
+int cache_restore(struct ag_project* project, struct ag_component* c, const char* key);
+
+// Stores outputs of the component in the cache under the given key, records the output digest of the component,
+// starts uploading the entry to the remote cache, if any, and evicts old entries, if the cache is too large.
+// Returns 0 on success.
+int cache_store(struct ag_project* project, struct ag_component* c, const char* key);
+
+// Forgets the output digest of the component (e.g. after it's been cleaned).
+void cache_forget_outputs(struct ag_project* project, struct ag_component* c);
+
+// Returns the test result key of the component, which should be freed, or NULL, if test results of the component
+// can't be cached (it has no test script, is not under version control, or it or some of its upstream components
+// have not been built). 'source_state' is the result of stamp_source_state().
+char* cache_test_key(struct ag_project* project, struct ag_component* c, const char* source_state);
+
+// Looks up a passing test result with the given key, and appends its output to 'log'. Returns 0 on success, or -1,
+// if there's no such result.
+int cache_test_restore(const char* key, struct buffer* log);
+
+// Records a passing test result with the given output under the given key. Returns 0 on success.
+int cache_test_store(const char* key, const struct buffer* log);
+
+// Evicts least recently used entries until the cache is not larger than 'limit' bytes.
+// Returns the number of evicted entries.
+int cache_evict(long long limit);
+
+// Reads cache statistics. Returns 0 on success.
+int cache_read_stats(struct cache_stats* stats);
+
+// Resets hit/miss statistics.
+void cache_reset_stats();
+
+#endif /* CACHE_H */
@@ -0,0 +1,247 @@
+// for asprintf()
+#define _GNU_SOURCE
+
+#include "cgroup.h"
+#include "common.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char* mount_points[] = { "/sys/fs/cgroup", "/sys/fs/cgroup/unified" };
+
+#define SUPERVISOR_LEAF "ag-supervisor"
+
+static int file_exists(const char* dir, const char* file_name) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, file_name);
+    return 0 == access(path, F_OK);
+}
+
+// Writes the value into the given file of the cgroup directory. Returns 0 on success.
+static int write_file(const char* dir, const char* file_name, const char* value) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, file_name);
+    FILE* fh = fopen(path, "w");
+    if (!fh) {
+        return -1;
+    }
+    int ret = (0 > fputs(value, fh)) ? -1 : 0;
+    if (fclose(fh)) {
+        ret = -1;
+    }
+    return ret;
+}
+
+// Returns the cgroup v2 path of the current process (e.g. "/user.slice/..."), which should be freed, or NULL.
+static char* own_cgroup() {
+    FILE* fh = fopen("/proc/self/cgroup", "r");
+    if (!fh) {
+        return NULL;
+    }
+    char line[4096];
+    char* ret = NULL;
+    while (!ret && fgets(line, sizeof(line), fh)) {
+        if (!strncmp(line, "0::", 3)) {
+            line[strcspn(line, "\n")] = '\0';
+            ret = xstrdup(line + 3);
+        }
+    }
+    fclose(fh);
+    return ret;
+}
+
+char* cgroup_setup(const char** error) {
+    assert(error);
+
+    const char* mount_point = NULL;
+    for (int i = 0; !mount_point && i < ARRAY_SIZE(mount_points); ++i) {
+        if (file_exists(mount_points[i], "cgroup.controllers")) {
+            mount_point = mount_points[i];
+        }
+    }
+    if (!mount_point) {
+        *error = "cgroup v2 is not mounted";
+        return NULL;
+    }
+    char* own = own_cgroup();
+    if (!own) {
+        *error = "unable to find cgroup v2 of the current process";
+        return NULL;
+    }
+    char* dir = NULL;
+    if (-1 == asprintf(&dir, "%s%s", mount_point, strcmp(own, "/") ? own : "")) {
+        die("Out of memory, asprintf failed");
+    }
+    free(own);
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/cgroup.procs", dir);
+    if (access(dir, W_OK) || access(path, W_OK)) {
+        *error = "current cgroup is not delegated to the user";
+        free(dir);
+        return NULL;
+    }
+
+    int is_root = !file_exists(dir, "cgroup.type");
+    if (!is_root) {
+        // a cgroup with processes can't distribute resources to its children, so move out of it
+        char* supervisor = NULL;
+        if (-1 == asprintf(&supervisor, "%s/" SUPERVISOR_LEAF, dir)) {
+            die("Out of memory, asprintf failed");
+        }
+        if (mkdir(supervisor, 0755) && EEXIST != errno) {
+            *error = "unable to create supervisor cgroup";
+            free(supervisor);
+            free(dir);
+            return NULL;
+        }
+        int rc = cgroup_enter(supervisor);
+        free(supervisor);
+        if (rc) {
+            *error = "unable to move into supervisor cgroup";
+            free(dir);
+            return NULL;
+        }
+    }
+
+    // enable whatever is available of the controllers we need; missing ones only reduce accounting
+    char controllers[1024] = { 0 };
+    snprintf(path, sizeof(path), "%s/cgroup.controllers", dir);
+    FILE* fh = fopen(path, "r");
+    if (fh) {
+        if (!fgets(controllers, sizeof(controllers), fh)) {
+            controllers[0] = '\0';
+        }
+        fclose(fh);
+    }
+    for (char* c = strtok(controllers, " \n"); c; c = strtok(NULL, " \n")) {
+        if (strcmp(c, "memory") && strcmp(c, "cpu") && strcmp(c, "io")) {
+            continue;
+        }
+        char value[32];
+        snprintf(value, sizeof(value), "+%s", c);
+        if (write_file(dir, "cgroup.subtree_control", value)) {
+            *error = "unable to enable controllers; other processes are still in the current cgroup";
+            free(dir);
+            return NULL;
+        }
+    }
+    return dir;
+}
+
+char* cgroup_create_leaf(const char* parent, const char* name, const char* memory_max, const char* cpu_max) {
+    assert(parent);
+    assert(name);
+
+    char* leaf = NULL;
+    if (-1 == asprintf(&leaf, "%s/ag-%s-%d", parent, name, (int)getpid())) {
+        die("Out of memory, asprintf failed");
+    }
+    for (char* p = leaf + strlen(parent) + 1; *p; ++p) {
+        if ('/' == *p) {
+            *p = '_';
+        }
+    }
+    if (mkdir(leaf, 0755) && EEXIST != errno) {
+        free(leaf);
+        return NULL;
+    }
+    if ((!empty(memory_max) && write_file(leaf, "memory.max", memory_max))
+            || (!empty(cpu_max) && write_file(leaf, "cpu.max", cpu_max))) {
+        perror(NULL);
+        fprintf(stderr, "Failed to apply limits to cgroup %s\n", leaf);
+    }
+    return leaf;
+}
+
+int cgroup_enter(const char* leaf) {
+    assert(leaf);
+    // "0" stands for the writing process itself
+    return write_file(leaf, "cgroup.procs", "0");
+}
+
+static long long read_single_value(const char* leaf, const char* file_name) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", leaf, file_name);
+    FILE* fh = fopen(path, "r");
+    if (!fh) {
+        return -1;
+    }
+    long long ret = -1;
+    if (1 != fscanf(fh, "%lld", &ret)) {
+        ret = -1;
+    }
+    fclose(fh);
+    return ret;
+}
+
+int cgroup_read_usage(const char* leaf, struct cgroup_usage* usage) {
+    assert(leaf);
+    assert(usage);
+
+    memset(usage, 0, sizeof(*usage));
+    usage->memory_peak = read_single_value(leaf, "memory.peak");
+    usage->io_read = -1;
+    usage->io_write = -1;
+
+    char path[4096];
+    char line[1024];
+    snprintf(path, sizeof(path), "%s/cpu.stat", leaf);
+    FILE* fh = fopen(path, "r");
+    if (!fh) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fh)) {
+        sscanf(line, "user_usec %lld", &usage->user_usec);
+        sscanf(line, "system_usec %lld", &usage->system_usec);
+    }
+    fclose(fh);
+
+    snprintf(path, sizeof(path), "%s/io.stat", leaf);
+    fh = fopen(path, "r");
+    if (fh) {
+        usage->io_read = 0;
+        usage->io_write = 0;
+        while (fgets(line, sizeof(line), fh)) {
+            // e.g. "8:0 rbytes=90430464 wbytes=299008000 rios=8950 wios=12252 dbytes=0 dios=0"
+            long long r = 0;
+            long long w = 0;
+            if (2 == sscanf(line, "%*s rbytes=%lld wbytes=%lld", &r, &w)) {
+                usage->io_read += r;
+                usage->io_write += w;
+            }
+        }
+        fclose(fh);
+    }
+    return 0;
+}
+
+void cgroup_remove(const char* leaf) {
+    assert(leaf);
+
+    if (write_file(leaf, "cgroup.kill", "1")) {
+        // older kernels: kill the remaining processes one by one
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/cgroup.procs", leaf);
+        FILE* fh = fopen(path, "r");
+        if (fh) {
+            int pid = 0;
+            while (1 == fscanf(fh, "%d", &pid)) {
+                kill(pid, SIGKILL);
+            }
+            fclose(fh);
+        }
+    }
+    // killed processes leave the cgroup asynchronously
+    for (int i = 0; i < 100 && rmdir(leaf) && EBUSY == errno; ++i) {
+        struct timespec ts = { 0, 10 * 1000 * 1000 };
+        nanosleep(&ts, NULL);
+    }
+}
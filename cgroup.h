@@ -0,0 +1,37 @@
+#ifndef CGROUP_H
+#define CGROUP_H
+
+// Isolation and accounting of component scripts with cgroup v2.
+//
+// The cgroup 'ag' runs in must be delegated to the user (e.g. 'systemd-run --user --scope -p Delegate=yes ag ...').
+// 'ag' moves itself into the 'ag-supervisor' leaf of that cgroup, enables controllers for the cgroup's children,
+// and then runs each script in its own leaf next to the supervisor.
+
+struct cgroup_usage {
+    long long memory_peak;  // bytes, or -1, if not available
+    long long user_usec;    // CPU time in user mode
+    long long system_usec;  // CPU time in kernel mode
+    long long io_read;      // bytes read, or -1, if not available
+    long long io_write;     // bytes written, or -1, if not available
+};
+
+// Prepares the current cgroup for running scripts in child cgroups.
+// Returns path to the directory, where leaves should be created, which should be freed.
+// On failure, returns NULL and sets *error to a static error message.
+char* cgroup_setup(const char** error);
+
+// Creates a leaf cgroup with the given name in the parent directory and applies limits (if not empty).
+// Values are written as is, e.g. "512M" or "max" for memory_max, and "50000 100000" for cpu_max.
+// Returns path to the leaf, which should be freed, or NULL on failure.
+char* cgroup_create_leaf(const char* parent, const char* name, const char* memory_max, const char* cpu_max);
+
+// Moves the calling process into the given cgroup. Returns 0 on success.
+int cgroup_enter(const char* leaf);
+
+// Reads resource usage of the whole process tree of the leaf. Returns 0 on success.
+int cgroup_read_usage(const char* leaf, struct cgroup_usage* usage);
+
+// Kills all processes left in the leaf, and removes it.
+void cgroup_remove(const char* leaf);
+
+#endif /* CGROUP_H */
@@ -0,0 +1,336 @@
+// for asprintf()
+#define _GNU_SOURCE
+
+#include "clone.h"
+#include "digest.h"
+#include "fsutil.h"
+#include "mirror.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define START_COLOR TERM_COLOR_CYAN
+#define FINISH_COLOR TERM_COLOR_GREEN
+
+static void checked_symlink(const char* name, const char* alias, int check_exist) {
+    if (empty(alias) || empty(name)) {
+        return;
+    }
+    if (symlink(name, alias)) {
+        if (check_exist || EEXIST != errno) {
+            perror(NULL);
+            fprintf(stderr, "Failed to create alias symlink %s -> %s\n", alias, name);
+        }
+    }
+}
+
+void clone_link_alias(const char* dir, struct ag_component* c) {
+    assert(c);
+
+    if (empty(c->alias)) {
+        return;
+    }
+    char* alias = NULL;
+    if (-1 == asprintf(&alias, "%s%s%s", dir ? dir : "", dir ? "/" : "", c->alias)) {
+        die("Out of memory, asprintf failed");
+    }
+    checked_symlink(c->name, alias, 1);
+    free(alias);
+}
+
+static int already_cloned(struct ag_component* c) {
+    if (dir_exists(c->name)) {
+        printf(FINISH_COLOR "Looks like component is already cloned: %s" TERM_COLOR_RESET "\n", c->name);
+        checked_symlink(c->name, c->alias, 0);
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+// Appends the string to the command line as is.
+static void append_str(struct buffer* b, const char* s) {
+    buffer_append(b, s, strlen(s));
+}
+
+// Appends the argument to the command line, quoted for the shell.
+static void append_arg(struct buffer* b, const char* arg) {
+    char* quoted = shell_quote(arg);
+    append_str(b, " ");
+    append_str(b, quoted);
+    free(quoted);
+}
+
+// Returns URL for git to clone from. Git ignores --depth and --filter for repositories given by local paths, so such
+// paths are turned into file:// URLs, when these options are used. The returned string should be freed.
+static char* git_url(const char* url, int shallow, const char* filter) {
+    if ((!shallow && !filter) || strstr(url, "://") || (strchr(url, ':') && strchr(url, ':') < strchr(url, '/'))) {
+        return xstrdup(url);
+    }
+    char* path = realpath(url, NULL);
+    char* ret = NULL;
+    if (!path || -1 == asprintf(&ret, "file://%s", path)) {
+        ret = xstrdup(url);
+    }
+    free(path);
+    return ret;
+}
+
+// Returns the command line to clone the component. If 'reference' is not NULL, it's a local repository to borrow
+// objects from (git only). The returned string should be freed.
+static char* create_cmdline(struct ag_project* project, struct ag_component* c, const char* reference) {
+    const struct ag_clone_options* p = &project->clone;
+    const struct ag_clone_options* o = &c->clone;
+    int depth = o->depth ? o->depth : p->depth;
+    const char* filter = o->filter ? o->filter : p->filter;
+    int single_branch = o->single_branch ? o->single_branch : p->single_branch;
+    const char* branch = o->branch ? o->branch : p->branch;
+    struct list* sparse = o->sparse ? o->sparse : p->sparse;
+
+    struct buffer b = { 0 };
+    if (c->git) {
+        append_str(&b, "git clone");
+        if (0 < depth) {
+            char arg[32];
+            snprintf(arg, sizeof(arg), " --depth %d", depth);
+            append_str(&b, arg);
+        }
+        if (filter) {
+            append_str(&b, " --filter=");
+            char* quoted = shell_quote(filter);
+            append_str(&b, quoted);
+            free(quoted);
+        }
+        if (single_branch) {
+            append_str(&b, 0 < single_branch ? " --single-branch" : " --no-single-branch");
+        }
+        if (branch) {
+            append_str(&b, " -b");
+            append_arg(&b, branch);
+        }
+        if (sparse) {
+            append_str(&b, " --sparse");
+        }
+        if (reference) {
+            append_str(&b, " --reference-if-able");
+            append_arg(&b, reference);
+        }
+        char* url = git_url(c->git, 0 < depth, filter);
+        append_arg(&b, url);
+        free(url);
+        append_arg(&b, c->name);
+        if (sparse) {
+            append_str(&b, " && git -C");
+            append_arg(&b, c->name);
+            append_str(&b, " sparse-checkout set");
+            for (struct list* l = sparse; l; l = l->next) {
+                append_arg(&b, (const char*)l->data);
+            }
+        }
+    } else if (c->hg) {
+        if (0 < depth || filter || sparse) {
+            printf(WARN_COLOR "Mercurial doesn't support depth, filter and sparse clone options, ignoring them for %s"
+                COLOR_RESET "\n", c->name);
+        }
+        append_str(&b, "hg clone");
+        if (0 < single_branch) {
+            // hg clone -b pulls only the given branch
+            append_str(&b, " -b");
+            append_arg(&b, branch ? branch : "default");
+        } else if (branch) {
+            append_str(&b, " -u");
+            append_arg(&b, branch);
+        }
+        append_arg(&b, c->hg);
+        append_arg(&b, c->name);
+    } else {
+        die("Unknown VCS for %s\n", c->name);
+    }
+    return b.data;
+}
+
+// Returns the file, which keeps the size of the last clone of the repository, in the user-level cache.
+static char* size_file(const char* url) {
+    char hex[DIGEST_HEX_SIZE];
+    digest_str_hex(url, hex);
+    char* dir = user_cache_dir("clone-sizes");
+    char* ret = NULL;
+    if (-1 == asprintf(&ret, "%s/%s", dir, hex)) {
+        die("Out of memory, asprintf failed");
+    }
+    free(dir);
+    return ret;
+}
+
+static long long read_clone_size(const char* url) {
+    char* file_name = size_file(url);
+    char* content = read_file(file_name);
+    long long ret = content ? atoll(content) : -1;
+    free(content);
+    free(file_name);
+    return ret;
+}
+
+static void write_clone_size(const char* url, long long size) {
+    char* file_name = size_file(url);
+    char content[32];
+    snprintf(content, sizeof(content), "%lld\n", size);
+    write_file_atomic(file_name, content);
+    free(file_name);
+}
+
+static const char* component_url(struct ag_component* c) {
+    return c->git ? c->git : c->hg;
+}
+
+static int finish_cloning(int status, const char* name, const char* alias, const char* cmdline) {
+    if (WIFEXITED(status)) {
+        if (WEXITSTATUS(status)) {
+            printf("Failed to clone %s. Please, run it manually:\n    %s\n", name, cmdline);
+        } else {
+            printf(FINISH_COLOR "Successfully cloned %s" TERM_COLOR_RESET "\n", name);
+            checked_symlink(name, alias, 1);
+            return 0;
+        }
+    } else {
+        printf("Stopped cloning %s\n", name);
+    }
+    return 1;
+}
+
+pid_t clone_job_start(struct clone_job* j, int output_fd) {
+    assert(j);
+
+    if (j->mirror) {
+        printf(START_COLOR "Updating mirror of %s" TERM_COLOR_RESET "\n", j->c->name);
+    } else {
+        printf(START_COLOR "Starting cloning %s" TERM_COLOR_RESET "\n", j->c->name);
+    }
+    fflush(stdout);
+    pid_t child_pid = run_cmd_line(j->cmdline, output_fd);
+    if (-1 == child_pid) {
+        perror(NULL);
+        fprintf(stderr, "Failed to run clone for %s\n", j->c->name);
+    }
+    return child_pid;
+}
+
+int clone_job_finish(struct clone_job* j, struct sched_job* job) {
+    assert(j);
+    assert(job);
+
+    int ok = WIFEXITED(job->status) && !WEXITSTATUS(job->status);
+    if (!ok && job->output.len) {
+        printf(PROP_COLOR "Output of %s:" COLOR_RESET "\n", j->c->name);
+        fwrite(job->output.data, 1, job->output.len, stdout);
+    }
+    if (j->mirror) {
+        // the clone doesn't need the mirror, so a failure here isn't fatal
+        if (mirror_finish(j->c->git, j->tmp_dir, ok)) {
+            printf(WARN_COLOR "Unable to update mirror of %s, cloning without it" COLOR_RESET "\n", j->c->name);
+        } else {
+            printf(FINISH_COLOR "Updated mirror of %s" TERM_COLOR_RESET "\n", j->c->name);
+        }
+        return 0;
+    }
+    int rc = finish_cloning(job->status, j->c->name, j->c->alias, j->cmdline);
+    if (!rc && -1 != j->mirror_job) {
+        mirror_add_user(j->c->git, j->c->name);
+    } else if (!rc) {
+        // clones, which borrow objects from a mirror, are much smaller than the repository
+        write_clone_size(component_url(j->c), tree_size(j->c->name));
+    }
+    return rc;
+}
+
+static int compare_clone_jobs(const void* a, const void* b) {
+    const struct clone_job* x = (const struct clone_job*)a;
+    const struct clone_job* y = (const struct clone_job*)b;
+    // repositories of unknown size go first, as they may be large
+    long long sx = (-1 == x->size) ? LLONG_MAX : x->size;
+    long long sy = (-1 == y->size) ? LLONG_MAX : y->size;
+    if (sx != sy) {
+        return sx < sy ? 1 : -1;
+    }
+    return x->order - y->order;
+}
+
+// Returns index of the job, which updates the mirror of the URL, or -1, if there's none.
+static int find_mirror_job(struct clone_job* jobs, int count, const char* url) {
+    for (int i = 0; i < count; ++i) {
+        if (jobs[i].mirror && !strcmp(url, jobs[i].c->git)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+struct clone_job* clone_jobs_create(struct ag_project* project, struct list* list, int skip_disabled, int use_mirror,
+    int largest_first, int* job_count) {
+
+    assert(project);
+    assert(job_count);
+
+    struct clone_job* clones = (struct clone_job*)xcalloc(project->component_count + 1, sizeof(struct clone_job));
+    int count = 0;
+    for (struct list* l = list; l; l = l->next) {
+        struct ag_component* c = (struct ag_component*)l->data;
+        if (skip_disabled && c->disabled) {
+            printf(WARN_COLOR "Skipping %s" COLOR_RESET "\n", c->name);
+            continue;
+        }
+        if (already_cloned(c)) {
+            continue;
+        }
+        clones[count].c = c;
+        clones[count].size = read_clone_size(component_url(c));
+        clones[count].order = count;
+        clones[count].mirror_job = -1;
+        ++count;
+    }
+    if (largest_first) {
+        // starting the largest clones first shortens the total time, as the small ones fill the gaps at the end
+        qsort(clones, count, sizeof(struct clone_job), &compare_clone_jobs);
+    }
+
+    // each mirror is updated by a job, which goes right before the first clone from it
+    struct clone_job* jobs = (struct clone_job*)xcalloc(2 * count + 1, sizeof(struct clone_job));
+    int n = 0;
+    for (int i = 0; i < count; ++i) {
+        struct ag_component* c = clones[i].c;
+        char* reference = NULL;
+        if (use_mirror && c->git) {
+            clones[i].mirror_job = find_mirror_job(jobs, n, c->git);
+            if (-1 == clones[i].mirror_job) {
+                clones[i].mirror_job = n;
+                jobs[n].c = c;
+                jobs[n].mirror = 1;
+                jobs[n].cmdline = mirror_update_cmdline(c->git, &jobs[n].tmp_dir);
+                jobs[n].mirror_job = -1;
+                ++n;
+            }
+            reference = mirror_dir(c->git);
+        }
+        clones[i].cmdline = create_cmdline(project, c, reference);
+        free(reference);
+        jobs[n++] = clones[i];
+    }
+    free(clones);
+
+    *job_count = n;
+    return jobs;
+}
+
+void clone_jobs_free(struct clone_job* jobs, int count) {
+    for (int i = 0; i < count; ++i) {
+        free(jobs[i].cmdline);
+        free(jobs[i].tmp_dir);
+    }
+    free(jobs);
+}
@@ -0,0 +1,41 @@
+#ifndef CLONE_H
+#define CLONE_H
+
+#include "agnostic.h"
+#include "scheduler.h"
+
+// Cloning of component repositories as scheduler jobs. Repositories are cloned into subdirectories of the working
+// directory, named after the components, and alias symlinks are created next to them.
+
+struct clone_job {
+    struct ag_component* c;
+    char* cmdline;
+    long long size;     // size of the last clone of the same repository in bytes, or -1, if unknown
+    int order;          // position of the component in the selection
+    int mirror;         // if 1, the job updates the mirror of the component's repository instead of cloning it
+    char* tmp_dir;      // directory, where a new mirror is cloned
+    int mirror_job;     // index of the job, which updates the mirror to clone from, or -1
+};
+
+// Creates the alias symlink of the component in the given directory (the working directory, if NULL), which points
+// to the component directory.
+void clone_link_alias(const char* dir, struct ag_component* c);
+
+// Creates jobs to clone components from the list, which are not cloned yet. If 'use_mirror' is 1, Git repositories
+// are cloned via local mirrors (see mirror.h), and jobs, which update the mirrors, are added before the first jobs,
+// which need them (the latter should wait for the former). If 'largest_first' is 1, repositories are ordered by sizes
+// of their previous clones, largest first. Returns the array of jobs, which should be freed with clone_jobs_free(),
+// and sets 'job_count'.
+struct clone_job* clone_jobs_create(struct ag_project* project, struct list* list, int skip_disabled, int use_mirror,
+    int largest_first, int* job_count);
+
+// Frees the jobs.
+void clone_jobs_free(struct clone_job* jobs, int count);
+
+// Starts the job. Returns child process PID, or -1 on failure.
+pid_t clone_job_start(struct clone_job* j, int output_fd);
+
+// Completes the job, which has been run as the scheduler job. Returns 0, if the job succeeded.
+int clone_job_finish(struct clone_job* j, struct sched_job* job);
+
+#endif /* CLONE_H */
@@ -1,5 +1,6 @@
 
 #include "common.h"
+#include "cgroup.h"
 
 #include <assert.h>
 #include <stdio.h>
@@ -7,6 +8,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <dirent.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
 
 void (*xexit)(int status) = &exit;
 
@@ -87,21 +93,45 @@ int dir_exists(const char* path) {
     }
 }
 
-pid_t run_cmd_line(const char* cmd_line, int supress_output) {
+pid_t run_cmd_line(const char* cmd_line, int output_fd) {
     assert(cmd_line);
 
     pid_t child_pid = xfork();
     if (0 == child_pid) {
-        if (supress_output) {
-            fclose(stdout);
-            fclose(stderr);
+        if (-1 != output_fd) {
+            dup2(output_fd, STDOUT_FILENO);
+            dup2(output_fd, STDERR_FILENO);
+            close(output_fd);
         }
         execl("/bin/sh", "sh", "-c", cmd_line, (char*)NULL);
-        return -1;
+        xexit(127);
     }
     return child_pid;
 }
 
+char* shell_quote(const char* s) {
+    struct buffer b = { 0 };
+    buffer_append(&b, "'", 1);
+    for (const char* p = s; *p; ++p) {
+        if ('\'' == *p) {
+            buffer_append(&b, "'\\''", 4);
+        } else {
+            buffer_append(&b, p, 1);
+        }
+    }
+    buffer_append(&b, "'", 1);
+    return b.data;
+}
+
+int parse_jobs(const char* s) {
+    char* end = NULL;
+    long ret = strtol(s, &end, 10);
+    if (!*s || *end || 1 > ret || ret > 4096) {
+        die("Invalid number of jobs: %s", s);
+    }
+    return (int)ret;
+}
+
 char* create_temp_file(const char* prefix, const char* content) {
     char* fname = NULL;
     if (-1 == asprintf(&fname, "/tmp/%sXXXXXXXXXX", prefix)) {
@@ -119,20 +149,187 @@ char* create_temp_file(const char* prefix, const char* content) {
     return fname;
 }
 
-pid_t run_script(const char* dir, const char* script_file_name) {
+char* read_file(const char* file_name) {
+    assert(file_name);
+
+    struct buffer b = { 0 };
+    if (read_file_buffer(file_name, &b)) {
+        return NULL;
+    }
+    if (!b.data) {
+        return xstrdup("");
+    }
+    return b.data;
+}
+
+int read_file_buffer(const char* file_name, struct buffer* b) {
+    assert(file_name);
+    assert(b);
+
+    int fd = open(file_name, O_RDONLY);
+    if (0 > fd) {
+        return -1;
+    }
+    struct buffer content = { 0 };
+    char buf[4096];
+    ssize_t n = 0;
+    while (0 != (n = read(fd, buf, sizeof(buf)))) {
+        if (0 < n) {
+            buffer_append(&content, buf, n);
+        } else if (EINTR != errno) {
+            close(fd);
+            buffer_free(&content);
+            return -1;
+        }
+    }
+    close(fd);
+    if (!b->data) {
+        *b = content;
+    } else {
+        buffer_append(b, content.data, content.len);
+        buffer_free(&content);
+    }
+    return 0;
+}
+
+int write_file_atomic(const char* file_name, const char* content) {
+    assert(content);
+
+    return write_data_atomic(file_name, content, strlen(content));
+}
+
+int write_data_atomic(const char* file_name, const char* data, size_t len) {
+    assert(file_name);
+    assert(data || !len);
+
+    char* tmp = NULL;
+    if (-1 == asprintf(&tmp, "%s.XXXXXX", file_name)) {
+        die("Out of memory, asprintf failed");
+    }
+    int fd = mkstemp(tmp);
+    if (0 > fd) {
+        free(tmp);
+        return -1;
+    }
+    int ret = (!len || (ssize_t)len == write(fd, data, len)) ? 0 : -1;
+    fchmod(fd, 0644);
+    if (close(fd) || ret || rename(tmp, file_name)) {
+        remove(tmp);
+        ret = -1;
+    }
+    free(tmp);
+    return ret;
+}
+
+pid_t run_script(const char* dir, const char* script_file_name, int output_fd, const char* cgroup, int new_group) {
     assert(script_file_name);
 
     pid_t child_pid = xfork();
     if (0 == child_pid) {
+        if (new_group) {
+            setpgid(0, 0);
+        }
+        // join the cgroup before exec, so that the whole process tree is accounted
+        if (cgroup && cgroup_enter(cgroup)) {
+            perror(cgroup);
+            xexit(1);
+        }
         if (dir && chdir(dir)) {
-            return -1;
+            perror(dir);
+            xexit(1);
+        }
+        if (-1 != output_fd) {
+            dup2(output_fd, STDOUT_FILENO);
+            dup2(output_fd, STDERR_FILENO);
+            close(output_fd);
         }
         execl("/bin/sh", "sh", "-xe", script_file_name, (char*)NULL);
-        return -1;
+        xexit(127);
+    }
+    if (new_group && 0 < child_pid) {
+        // also done by the parent, so that the group exists as soon as this returns
+        setpgid(child_pid, child_pid);
     }
     return child_pid;
 }
 
+int run_cmd_capture(const char* dir, const char* cmd_line, struct buffer* out) {
+    assert(cmd_line);
+    assert(out);
+
+    int fds[2];
+    if (pipe(fds)) {
+        return -1;
+    }
+    pid_t child_pid = xfork();
+    if (0 == child_pid) {
+        close(fds[0]);
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[1]);
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (0 <= null_fd) {
+            dup2(null_fd, STDERR_FILENO);
+            close(null_fd);
+        }
+        if (dir && chdir(dir)) {
+            xexit(127);
+        }
+        execl("/bin/sh", "sh", "-c", cmd_line, (char*)NULL);
+        xexit(127);
+    }
+    close(fds[1]);
+    if (-1 == child_pid) {
+        close(fds[0]);
+        return -1;
+    }
+    char buf[4096];
+    ssize_t n = 0;
+    while (0 != (n = read(fds[0], buf, sizeof(buf)))) {
+        if (0 < n) {
+            buffer_append(out, buf, n);
+        } else if (EINTR != errno) {
+            break;
+        }
+    }
+    close(fds[0]);
+    int status = 0;
+    while (0 > waitpid(child_pid, &status, 0)) {
+        if (EINTR != errno) {
+            return -1;
+        }
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void buffer_append(struct buffer* b, const char* data, size_t len) {
+    assert(b);
+    if (b->len + len + 1 > b->cap) {
+        size_t cap = b->cap ? b->cap : 256;
+        while (b->len + len + 1 > cap) {
+            cap *= 2;
+        }
+        b->data = (char*)xrealloc(b->data, cap);
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    b->data[b->len] = '\0';
+}
+
+void buffer_free(struct buffer* b) {
+    assert(b);
+    free(b->data);
+    b->data = NULL;
+    b->len = 0;
+    b->cap = 0;
+}
+
 struct list* list_create(void* data, struct list* next) {
     if (!data) {
         return NULL;
@@ -57,11 +57,54 @@ int dir_exists(const char* path);
 // Returns NULL on failure.
 char* create_temp_file(const char* prefix, const char* content);
 
+// Reads the whole file. Returns its null-terminated contents, which should be freed, or NULL on failure.
+char* read_file(const char* file_name);
+
+// Writes the content into the file atomically (via a temporary file and rename). Returns 0 on success.
+int write_file_atomic(const char* file_name, const char* content);
+
 // Runs the given command line. Returns child process PID, or -1 on failure.
-pid_t run_cmd_line(const char* cmd_line, int supress_output);
+// If output_fd is not -1, the command's stdout and stderr are redirected to it.
+pid_t run_cmd_line(const char* cmd_line, int output_fd);
+
+// Returns the string quoted for the shell, which should be freed.
+char* shell_quote(const char* s);
+
+// Parses the number of jobs for the -j option. Calls die() on invalid value.
+int parse_jobs(const char* s);
 
 // Runs script with the given file name from the given directory. Returns child process PID, or -1 on failure.
-pid_t run_script(const char* dir, const char* script_file_name);
+// If output_fd is not -1, the script's stdout and stderr are redirected to it.
+// If cgroup is not NULL, the script is started in this cgroup v2 directory.
+// If new_group is 1, the script runs in its own process group, so that it can be killed with all its children.
+pid_t run_script(const char* dir, const char* script_file_name, int output_fd, const char* cgroup, int new_group);
+
+// Returns monotonic time in milliseconds.
+long long now_ms();
+
+// Growable byte buffer.
+struct buffer {
+    char* data;
+    size_t len;
+    size_t cap;
+};
+
+// Appends len bytes to the buffer. The buffer data is always null-terminated.
+void buffer_append(struct buffer* b, const char* data, size_t len);
+
+// Frees the buffer data and resets it to empty state.
+void buffer_free(struct buffer* b);
+
+// Appends the whole file, which may contain null bytes, to the buffer. Returns 0 on success; the buffer is left
+// unchanged on failure.
+int read_file_buffer(const char* file_name, struct buffer* b);
+
+// Writes 'len' bytes of data into the file atomically (via a temporary file and rename). Returns 0 on success.
+int write_data_atomic(const char* file_name, const char* data, size_t len);
+
+// Runs the command line in the given directory (if not NULL) and collects its standard output into 'out'.
+// Standard error is discarded. Returns exit code of the command, or -1, if it couldn't be run or was killed.
+int run_cmd_capture(const char* dir, const char* cmd_line, struct buffer* out);
 
 struct list {
     void* data;
@@ -0,0 +1,145 @@
+
+#include "digest.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static const uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void transform(struct digest* d, const unsigned char* block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i) {
+        w[i] = ((uint32_t)block[4 * i] << 24) | ((uint32_t)block[4 * i + 1] << 16)
+            | ((uint32_t)block[4 * i + 2] << 8) | (uint32_t)block[4 * i + 3];
+    }
+    for (int i = 16; i < 64; ++i) {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = d->state[0], b = d->state[1], c = d->state[2], e = d->state[4];
+    uint32_t dd = d->state[3], f = d->state[5], g = d->state[6], h = d->state[7];
+    for (int i = 0; i < 64; ++i) {
+        uint32_t s1 = ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + k[i] + w[i];
+        uint32_t s0 = ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+        h = g;
+        g = f;
+        f = e;
+        e = dd + t1;
+        dd = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    d->state[0] += a;
+    d->state[1] += b;
+    d->state[2] += c;
+    d->state[3] += dd;
+    d->state[4] += e;
+    d->state[5] += f;
+    d->state[6] += g;
+    d->state[7] += h;
+}
+
+void digest_init(struct digest* d) {
+    assert(d);
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(d->state, initial, sizeof(initial));
+    d->length = 0;
+    d->block_len = 0;
+}
+
+void digest_update(struct digest* d, const void* data, size_t len) {
+    assert(d);
+    const unsigned char* p = (const unsigned char*)data;
+    d->length += len;
+    while (len) {
+        size_t n = sizeof(d->block) - d->block_len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(d->block + d->block_len, p, n);
+        d->block_len += n;
+        p += n;
+        len -= n;
+        if (sizeof(d->block) == d->block_len) {
+            transform(d, d->block);
+            d->block_len = 0;
+        }
+    }
+}
+
+void digest_update_str(struct digest* d, const char* s) {
+    if (!s) {
+        s = "";
+    }
+    digest_update(d, s, strlen(s) + 1);
+}
+
+void digest_final_hex(struct digest* d, char hex[DIGEST_HEX_SIZE]) {
+    assert(d);
+    uint64_t bits = d->length * 8;
+    unsigned char pad = 0x80;
+    digest_update(d, &pad, 1);
+    pad = 0;
+    while (56 != d->block_len) {
+        digest_update(d, &pad, 1);
+    }
+    unsigned char len[8];
+    for (int i = 0; i < 8; ++i) {
+        len[i] = (unsigned char)(bits >> (56 - 8 * i));
+    }
+    digest_update(d, len, sizeof(len));
+
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < DIGEST_SIZE; ++i) {
+        unsigned char byte = (unsigned char)(d->state[i / 4] >> (24 - 8 * (i % 4)));
+        hex[2 * i] = digits[byte >> 4];
+        hex[2 * i + 1] = digits[byte & 0xf];
+    }
+    hex[2 * DIGEST_SIZE] = '\0';
+}
+
+int digest_update_file(struct digest* d, const char* file_name) {
+    int fd = open(file_name, O_RDONLY);
+    if (0 > fd) {
+        return -1;
+    }
+    char buf[65536];
+    ssize_t n = 0;
+    while (0 < (n = read(fd, buf, sizeof(buf)))) {
+        digest_update(d, buf, n);
+    }
+    close(fd);
+    return 0 > n ? -1 : 0;
+}
+
+void digest_str_hex(const char* s, char hex[DIGEST_HEX_SIZE]) {
+    struct digest d;
+    digest_init(&d);
+    if (s) {
+        digest_update(&d, s, strlen(s));
+    }
+    digest_final_hex(&d, hex);
+}
@@ -0,0 +1,36 @@
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// SHA-256 message digest.
+
+#define DIGEST_SIZE 32
+#define DIGEST_HEX_SIZE (2 * DIGEST_SIZE + 1)
+
+struct digest {
+    uint32_t state[8];
+    uint64_t length;
+    unsigned char block[64];
+    size_t block_len;
+};
+
+void digest_init(struct digest* d);
+
+void digest_update(struct digest* d, const void* data, size_t len);
+
+// Same as digest_update(), but includes the terminating '\0', so that concatenated strings can't collide.
+// NULL is treated as an empty string.
+void digest_update_str(struct digest* d, const char* s);
+
+// Finishes the digest and writes it as a lowercase hex string into 'hex'.
+void digest_final_hex(struct digest* d, char hex[DIGEST_HEX_SIZE]);
+
+// Adds contents of the file to the digest. Returns 0 on success.
+int digest_update_file(struct digest* d, const char* file_name);
+
+// Computes hex digest of the string.
+void digest_str_hex(const char* s, char hex[DIGEST_HEX_SIZE]);
+
+#endif /* DIGEST_H */
@@ -0,0 +1,113 @@
+// for asprintf()
+#define _GNU_SOURCE
+
+#include "durations.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct duration {
+    char* component;
+    long long ms;
+};
+
+struct durations {
+    char* file_name;
+    struct duration* items;
+    int count;
+    int cap;
+};
+
+static struct duration* find(struct durations* d, const char* component) {
+    for (int i = 0; i < d->count; ++i) {
+        if (!strcmp(component, d->items[i].component)) {
+            return d->items + i;
+        }
+    }
+    return NULL;
+}
+
+static void add(struct durations* d, const char* component, long long ms) {
+    if (d->count == d->cap) {
+        d->cap = d->cap ? 2 * d->cap : 32;
+        d->items = (struct duration*)xrealloc(d->items, d->cap * sizeof(struct duration));
+    }
+    d->items[d->count].component = xstrdup(component);
+    d->items[d->count].ms = ms;
+    ++d->count;
+}
+
+struct durations* durations_load(struct ag_project* project, const char* script) {
+    assert(project);
+    assert(script);
+
+    struct durations* d = (struct durations*)xcalloc(1, sizeof(struct durations));
+    char* name = NULL;
+    if (-1 == asprintf(&name, "durations/%s", script)) {
+        die("Out of memory, asprintf failed");
+    }
+    d->file_name = ag_state_file(project, name);
+    free(name);
+
+    char* content = read_file(d->file_name);
+    char* save = NULL;
+    for (char* line = content ? strtok_r(content, "\n", &save) : NULL; line; line = strtok_r(NULL, "\n", &save)) {
+        char* component = strchr(line, ' ');
+        if (component && component[1] && !find(d, component + 1)) {
+            add(d, component + 1, atoll(line));
+        }
+    }
+    free(content);
+    return d;
+}
+
+void durations_free(struct durations* d) {
+    if (!d) {
+        return;
+    }
+    for (int i = 0; i < d->count; ++i) {
+        free(d->items[i].component);
+    }
+    free(d->items);
+    free(d->file_name);
+    free(d);
+}
+
+long long durations_get(struct durations* d, const char* component) {
+    assert(d);
+    assert(component);
+
+    struct duration* item = find(d, component);
+    return item ? item->ms : -1;
+}
+
+void durations_add(struct durations* d, const char* component, long long ms) {
+    assert(d);
+    assert(component);
+
+    struct duration* item = find(d, component);
+    if (item) {
+        // recent runs matter more, but a single outlier shouldn't change the average too much
+        item->ms = (item->ms + ms) / 2;
+    } else {
+        add(d, component, ms);
+    }
+}
+
+int durations_save(struct durations* d) {
+    assert(d);
+
+    struct buffer b = { 0 };
+    for (int i = 0; i < d->count; ++i) {
+        char line[64];
+        snprintf(line, sizeof(line), "%lld ", d->items[i].ms);
+        buffer_append(&b, line, strlen(line));
+        buffer_append(&b, d->items[i].component, strlen(d->items[i].component));
+        buffer_append(&b, "\n", 1);
+    }
+    int ret = write_file_atomic(d->file_name, b.len ? b.data : "");
+    buffer_free(&b);
+    return ret;
+}
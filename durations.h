@@ -0,0 +1,26 @@
+#ifndef DURATIONS_H
+#define DURATIONS_H
+
+#include "agnostic.h"
+
+// History of script durations. For each component, a moving average of the durations of its script runs is kept in
+// the .agnostic/durations/<script> file of the project. Each line of the file is "<milliseconds> <component name>".
+
+struct durations;
+
+// Loads durations of the given script. Never returns NULL: if there's no history, the returned history is empty.
+struct durations* durations_load(struct ag_project* project, const char* script);
+
+// Frees the history.
+void durations_free(struct durations* d);
+
+// Returns the average duration of the component's script in milliseconds, or -1, if it's unknown.
+long long durations_get(struct durations* d, const char* component);
+
+// Adds a measured duration of the component's script to the history.
+void durations_add(struct durations* d, const char* component, long long ms);
+
+// Saves the history. Returns 0 on success.
+int durations_save(struct durations* d);
+
+#endif /* DURATIONS_H */
@@ -0,0 +1,307 @@
+
+// for copy_file_range()
+#define _GNU_SOURCE
+
+#include "fsutil.h"
+#include "common.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+static int copy_data(int in, int out, int flags) {
+#ifdef FICLONE
+    if ((flags & COPY_REFLINK) && 0 == ioctl(out, FICLONE, in)) {
+        return 0;
+    }
+#endif
+#if defined(__linux__) && defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+    // copy_file_range() copies inside the kernel, and may still share blocks on some file systems
+    ssize_t n = 0;
+    while (0 < (n = copy_file_range(in, NULL, out, NULL, 1 << 30, 0))) {
+    }
+    if (0 == n) {
+        return 0;
+    }
+    if (EXDEV != errno && ENOSYS != errno && EINVAL != errno && EOPNOTSUPP != errno) {
+        return -1;
+    }
+    // nothing has been copied yet, if the call is not supported at all
+    if (0 != lseek(out, 0, SEEK_CUR)) {
+        return -1;
+    }
+#endif
+    char buf[65536];
+    ssize_t r = 0;
+    while (0 != (r = read(in, buf, sizeof(buf)))) {
+        if (0 > r) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return -1;
+        }
+        for (ssize_t w = 0; w < r; ) {
+            ssize_t x = write(out, buf + w, r - w);
+            if (0 > x) {
+                if (EINTR == errno) {
+                    continue;
+                }
+                return -1;
+            }
+            w += x;
+        }
+    }
+    return 0;
+}
+
+// Creates 'dst', which shares data blocks with 'src'. Returns 0 on success. On failure, 'dst' doesn't exist.
+static int reflink_file(const char* src, const char* dst, const struct stat* st) {
+#ifdef FICLONE
+    int in = open(src, O_RDONLY);
+    if (0 > in) {
+        return -1;
+    }
+    int out = open(dst, O_WRONLY | O_CREAT | O_EXCL, st->st_mode & 07777);
+    if (0 > out) {
+        close(in);
+        return -1;
+    }
+    int ret = ioctl(out, FICLONE, in);
+    if (close(out)) {
+        ret = -1;
+    }
+    close(in);
+    if (ret) {
+        unlink(dst);
+    }
+    return ret;
+#else
+    return -1;
+#endif
+}
+
+static int copy_file(const char* src, const char* dst, const struct stat* st, int flags) {
+    if ((flags & COPY_HARDLINK) && 0 == link(src, dst)) {
+        return 0;
+    }
+    if ((flags & COPY_HARDLINK_FALLBACK) && (0 == reflink_file(src, dst, st) || 0 == link(src, dst))) {
+        return 0;
+    }
+    int in = open(src, O_RDONLY);
+    if (0 > in) {
+        return -1;
+    }
+    int out = open(dst, O_WRONLY | O_CREAT | O_EXCL, st->st_mode & 07777);
+    if (0 > out) {
+        close(in);
+        return -1;
+    }
+    int ret = copy_data(in, out, flags);
+    if (close(out)) {
+        ret = -1;
+    }
+    close(in);
+    return ret;
+}
+
+int copy_tree(const char* src, const char* dst, int flags) {
+    assert(src);
+    assert(dst);
+
+    struct stat st;
+    if (lstat(src, &st)) {
+        return -1;
+    }
+    if (S_ISLNK(st.st_mode)) {
+        char target[4096];
+        ssize_t n = readlink(src, target, sizeof(target) - 1);
+        if (0 > n) {
+            return -1;
+        }
+        target[n] = '\0';
+        return symlink(target, dst);
+    }
+    if (S_ISREG(st.st_mode)) {
+        return copy_file(src, dst, &st, flags);
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        // sockets, fifos and devices are not copied
+        return 0;
+    }
+
+    if (mkdir(dst, (st.st_mode & 07777) | S_IRWXU)) {
+        return -1;
+    }
+    DIR* dir = opendir(src);
+    if (!dir) {
+        return -1;
+    }
+    int ret = 0;
+    struct dirent* e = NULL;
+    while (!ret && (e = readdir(dir))) {
+        if (!strcmp(".", e->d_name) || !strcmp("..", e->d_name)) {
+            continue;
+        }
+        char* s = NULL;
+        char* d = NULL;
+        if (-1 == asprintf(&s, "%s/%s", src, e->d_name) || -1 == asprintf(&d, "%s/%s", dst, e->d_name)) {
+            die("Out of memory, asprintf failed");
+        }
+        ret = copy_tree(s, d, flags);
+        free(s);
+        free(d);
+    }
+    closedir(dir);
+    chmod(dst, st.st_mode & 07777);
+    return ret;
+}
+
+int remove_tree_at(int dir_fd, const char* name) {
+    assert(name);
+
+    if (0 == unlinkat(dir_fd, name, 0)) {
+        return 0;
+    }
+    if (ENOENT == errno) {
+        return 0;
+    }
+    if (EISDIR != errno && EPERM != errno) {
+        return -1;
+    }
+    int fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    if (0 > fd) {
+        return -1;
+    }
+    DIR* dir = fdopendir(fd);
+    if (!dir) {
+        close(fd);
+        return -1;
+    }
+    int ret = 0;
+    struct dirent* e = NULL;
+    while ((e = readdir(dir))) {
+        if (!strcmp(".", e->d_name) || !strcmp("..", e->d_name)) {
+            continue;
+        }
+        if (DT_DIR == e->d_type || DT_UNKNOWN == e->d_type) {
+            if (remove_tree_at(fd, e->d_name)) {
+                ret = -1;
+            }
+        } else if (unlinkat(fd, e->d_name, 0) && ENOENT != errno) {
+            ret = -1;
+        }
+    }
+    closedir(dir);
+    if (unlinkat(dir_fd, name, AT_REMOVEDIR) && ENOENT != errno) {
+        ret = -1;
+    }
+    return ret;
+}
+
+int remove_tree(const char* path) {
+    assert(path);
+    return remove_tree_at(AT_FDCWD, path);
+}
+
+long long tree_size(const char* path) {
+    assert(path);
+
+    struct stat st;
+    if (lstat(path, &st)) {
+        return 0;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        return S_ISREG(st.st_mode) ? (long long)st.st_size : 0;
+    }
+    DIR* dir = opendir(path);
+    if (!dir) {
+        return 0;
+    }
+    long long ret = 0;
+    struct dirent* e = NULL;
+    while ((e = readdir(dir))) {
+        if (!strcmp(".", e->d_name) || !strcmp("..", e->d_name)) {
+            continue;
+        }
+        char* p = NULL;
+        if (-1 == asprintf(&p, "%s/%s", path, e->d_name)) {
+            die("Out of memory, asprintf failed");
+        }
+        ret += tree_size(p);
+        free(p);
+    }
+    closedir(dir);
+    return ret;
+}
+
+int make_dirs(const char* path, mode_t mode) {
+    assert(path);
+
+    char* p = xstrdup(path);
+    for (char* s = strchr(p + 1, '/'); s; s = strchr(s + 1, '/')) {
+        *s = '\0';
+        mkdir(p, mode);
+        *s = '/';
+    }
+    int ret = (mkdir(p, mode) && EEXIST != errno) ? -1 : 0;
+    free(p);
+    return ret;
+}
+
+int path_exists(const char* path) {
+    struct stat st;
+    return 0 == lstat(path, &st);
+}
+
+int is_inner_path(const char* path) {
+    if (!path || '\0' == *path || '/' == *path) {
+        return 0;
+    }
+    int inner = 0;
+    for (const char* p = path; *p; ) {
+        size_t len = strcspn(p, "/");
+        if (2 == len && !strncmp("..", p, 2)) {
+            return 0;
+        }
+        if (len && !(1 == len && '.' == *p)) {
+            inner = 1;
+        }
+        p += len;
+        while ('/' == *p) {
+            ++p;
+        }
+    }
+    return inner;
+}
+
+char* user_cache_dir(const char* name) {
+    assert(name);
+
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    char* ret = NULL;
+    int rc = 0;
+    if (!empty(xdg)) {
+        rc = asprintf(&ret, "%s/agnostic/%s", xdg, name);
+    } else {
+        rc = asprintf(&ret, "%s/.cache/agnostic/%s", empty(home) ? "/tmp" : home, name);
+    }
+    if (-1 == rc) {
+        die("Out of memory, asprintf failed");
+    }
+    if (make_dirs(ret, 0755)) {
+        perror(ret);
+        die("Unable to create cache directory");
+    }
+    return ret;
+}
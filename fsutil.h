@@ -0,0 +1,41 @@
+#ifndef FSUTIL_H
+#define FSUTIL_H
+
+#include <sys/types.h>
+
+// File tree utilities.
+
+enum copy_flags {
+    COPY_REFLINK = 1,   // try to share data blocks with the source (FICLONE), where the file system supports it
+    COPY_HARDLINK = 2,  // try to hardlink regular files instead of copying them
+    COPY_HARDLINK_FALLBACK = 4  // try to reflink regular files, then to hardlink them, if reflinks are not supported
+};
+
+// Copies file, symlink or directory tree 'src' to 'dst', which must not exist. Symlinks are copied as symlinks.
+// If some method of 'flags' is not supported, falls back to a plain copy. Returns 0 on success.
+int copy_tree(const char* src, const char* dst, int flags);
+
+// Removes file, symlink or directory tree. Symlinks are not followed. Returns 0 on success (also if path doesn't exist).
+int remove_tree(const char* path);
+
+// Removes directory tree relative to the directory file descriptor. Returns 0 on success.
+int remove_tree_at(int dir_fd, const char* name);
+
+// Returns the total size of regular files in the tree, in bytes.
+long long tree_size(const char* path);
+
+// Creates the directory with all its parents. Returns 0 on success (also if the directory exists).
+int make_dirs(const char* path, mode_t mode);
+
+// Returns 1, if something (file, dir or symlink) exists at the given path.
+int path_exists(const char* path);
+
+// Returns 1, if the path is a non-empty relative path, which stays inside of its base directory: it's not ".", and
+// none of its segments is "..".
+int is_inner_path(const char* path);
+
+// Returns path to the given subdirectory of the user-level Agnostic cache ($XDG_CACHE_HOME/agnostic, or
+// ~/.cache/agnostic), which should be freed. Creates the directory, if needed.
+char* user_cache_dir(const char* name);
+
+#endif /* FSUTIL_H */
@@ -0,0 +1,119 @@
+// for asprintf()
+#define _GNU_SOURCE
+
+#include "journal.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct journal {
+    FILE* file;
+};
+
+static char* journal_file(struct ag_project* project, const char* script) {
+    char* name = NULL;
+    if (-1 == asprintf(&name, "journals/%s", script)) {
+        die("Out of memory, asprintf failed");
+    }
+    char* ret = ag_state_file(project, name);
+    free(name);
+    return ret;
+}
+
+void journal_plan(struct ag_project* project, struct list* components, int skip_disabled, char plan[DIGEST_HEX_SIZE]) {
+    assert(project);
+
+    struct digest d;
+    digest_init(&d);
+    digest_update_file(&d, project->file);
+    digest_update_str(&d, skip_disabled ? "skip disabled" : "");
+    for (struct list* l = components; l; l = l->next) {
+        digest_update_str(&d, ((struct ag_component*)l->data)->name);
+    }
+    digest_final_hex(&d, plan);
+}
+
+int journal_load(struct ag_project* project, const char* script, const char* plan, struct list** done, int* complete) {
+    assert(project);
+    assert(script);
+    assert(plan);
+    assert(done);
+    assert(complete);
+
+    *done = NULL;
+    *complete = 0;
+    char* file_name = journal_file(project, script);
+    char* content = read_file(file_name);
+    free(file_name);
+    if (!content) {
+        return -1;
+    }
+
+    int ret = -1;
+    struct list* tail = NULL;
+    char* save = NULL;
+    for (char* line = strtok_r(content, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        if (!strncmp("plan ", line, 5)) {
+            ret = strcmp(plan, line + 5) ? -1 : 0;
+        } else if (!strncmp("done ", line, 5)) {
+            list_add(done, &tail, xstrdup(line + 5));
+        } else if (!strcmp("complete", line)) {
+            *complete = 1;
+        }
+    }
+    free(content);
+    if (ret) {
+        list_free(*done, &free);
+        *done = NULL;
+        *complete = 0;
+    }
+    return ret;
+}
+
+struct journal* journal_start(struct ag_project* project, const char* script, const char* plan, int resume) {
+    assert(project);
+    assert(script);
+    assert(plan);
+
+    char* file_name = journal_file(project, script);
+    int ok = 1;
+    if (!resume) {
+        char* header = NULL;
+        if (-1 == asprintf(&header, "plan %s\n", plan)) {
+            die("Out of memory, asprintf failed");
+        }
+        ok = !write_file_atomic(file_name, header);
+        free(header);
+    }
+    FILE* f = ok ? fopen(file_name, "a") : NULL;
+    free(file_name);
+    if (!f) {
+        return NULL;
+    }
+    struct journal* j = (struct journal*)xcalloc(1, sizeof(struct journal));
+    j->file = f;
+    return j;
+}
+
+void journal_record(struct journal* j, const char* component) {
+    assert(j);
+    assert(component);
+
+    fprintf(j->file, "done %s\n", component);
+    // the record must survive the process being killed right after this
+    fflush(j->file);
+}
+
+void journal_finish(struct journal* j, int complete) {
+    if (!j) {
+        return;
+    }
+    if (complete) {
+        fprintf(j->file, "complete\n");
+    }
+    fclose(j->file);
+    free(j);
+}
@@ -0,0 +1,33 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "agnostic.h"
+#include "digest.h"
+
+// Run journals. While a script runs for a list of components (a plan), each component, which has been completed,
+// is recorded in the journal, so that an interrupted or failed run can be resumed later. A journal is valid only
+// for the same plan: the same project file and the same list of components.
+//
+// Journals are kept in the .agnostic/journals directory of the project, one per script (build, clean, test).
+
+struct journal;
+
+// Computes digest of the plan: contents of the project file and the list of components (ag_component list).
+void journal_plan(struct ag_project* project, struct list* components, int skip_disabled, char plan[DIGEST_HEX_SIZE]);
+
+// Reads the journal of the given script. If it's for the given plan, returns 0 and sets '*done' to a string list of
+// completed component names (should be freed with list_free(*done, &free)), and '*complete' to 1, if the whole plan
+// has been completed. Otherwise, returns -1.
+int journal_load(struct ag_project* project, const char* script, const char* plan, struct list** done, int* complete);
+
+// Starts recording the journal of the given script for the plan. If 'resume' is 1, keeps the existing records.
+// Returns NULL on failure.
+struct journal* journal_start(struct ag_project* project, const char* script, const char* plan, int resume);
+
+// Records completion of the component.
+void journal_record(struct journal* j, const char* component);
+
+// Finishes recording. If 'complete' is 1, marks the whole plan completed.
+void journal_finish(struct journal* j, int complete);
+
+#endif /* JOURNAL_H */
@@ -0,0 +1,265 @@
+// for asprintf()
+#define _GNU_SOURCE
+
+#include "mirror.h"
+#include "digest.h"
+#include "fsutil.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// Files, which Agnostic keeps in a mirror besides the repository itself.
+#define URL_FILE "agnostic-url"
+#define USERS_FILE "agnostic-users"
+
+// Leftovers of interrupted clones are removed after this number of seconds.
+#define STALE_TMP_SECONDS (24 * 60 * 60)
+
+// Workspaces borrow objects from the mirror, so objects, which become unreachable in the mirror (e.g. after
+// a force-push upstream), must never be pruned, see '--reference' in git-clone(1).
+#define KEEP_OBJECTS_CONFIG "-c gc.pruneExpire=never -c gc.auto=0"
+
+static char* path_join(const char* a, const char* b) {
+    char* ret = NULL;
+    if (-1 == asprintf(&ret, "%s/%s", a, b)) {
+        die("Out of memory, asprintf failed");
+    }
+    return ret;
+}
+
+static int has_suffix(const char* s, const char* suffix) {
+    size_t len = strlen(s);
+    size_t suffix_len = strlen(suffix);
+    return len >= suffix_len && !strcmp(s + len - suffix_len, suffix);
+}
+
+char* mirror_dir(const char* url) {
+    assert(url);
+
+    char hex[DIGEST_HEX_SIZE];
+    digest_str_hex(url, hex);
+    char* root = user_cache_dir("mirrors");
+    char* ret = NULL;
+    if (-1 == asprintf(&ret, "%s/%s.git", root, hex)) {
+        die("Out of memory, asprintf failed");
+    }
+    free(root);
+    return ret;
+}
+
+char* mirror_update_cmdline(const char* url, char** tmp_dir) {
+    assert(url);
+    assert(tmp_dir);
+
+    char* dir = mirror_dir(url);
+    char* ret = NULL;
+    int rc = 0;
+    if (dir_exists(dir)) {
+        *tmp_dir = NULL;
+        char* quoted = shell_quote(dir);
+        // the config is set again, as older mirrors have been cloned without it
+        rc = asprintf(&ret, "git --git-dir=%s config gc.pruneExpire never && git --git-dir=%s config gc.auto 0"
+            " && git --git-dir=%s fetch", quoted, quoted, quoted);
+        free(quoted);
+    } else {
+        // cloned aside and moved into place, so that a mirror is never seen half-cloned
+        if (-1 == asprintf(tmp_dir, "%s.%d.tmp", dir, (int)getpid())) {
+            die("Out of memory, asprintf failed");
+        }
+        char* quoted_url = shell_quote(url);
+        char* quoted_tmp = shell_quote(*tmp_dir);
+        rc = asprintf(&ret, "git clone --mirror " KEEP_OBJECTS_CONFIG " %s %s", quoted_url, quoted_tmp);
+        free(quoted_url);
+        free(quoted_tmp);
+    }
+    if (-1 == rc) {
+        die("Out of memory, asprintf failed");
+    }
+    free(dir);
+    return ret;
+}
+
+int mirror_finish(const char* url, const char* tmp_dir, int ok) {
+    assert(url);
+
+    char* dir = mirror_dir(url);
+    int ret = !ok;
+    if (tmp_dir) {
+        if (ok) {
+            char* url_file = path_join(tmp_dir, URL_FILE);
+            char* content = NULL;
+            if (-1 == asprintf(&content, "%s\n", url)) {
+                die("Out of memory, asprintf failed");
+            }
+            write_file_atomic(url_file, content);
+            free(content);
+            free(url_file);
+        }
+        if (!ok || rename(tmp_dir, dir)) {
+            // failed, or another process has created the mirror meanwhile
+            remove_tree(tmp_dir);
+            ret = !dir_exists(dir);
+        }
+    }
+    if (!ret) {
+        // the modification time of the mirror directory is its last use time
+        utimes(dir, NULL);
+    }
+    free(dir);
+    return ret;
+}
+
+void mirror_add_user(const char* url, const char* repo_dir) {
+    assert(url);
+    assert(repo_dir);
+
+    char* dir = mirror_dir(url);
+    char* users_file = path_join(dir, USERS_FILE);
+    char path[PATH_MAX];
+    int fd = realpath(repo_dir, path) ? open(users_file, O_WRONLY | O_CREAT | O_APPEND, 0644) : -1;
+    if (0 <= fd) {
+        // a single short write to a file opened for appending doesn't interleave with other writers
+        size_t len = strlen(path);
+        path[len] = '\n';
+        write(fd, path, len + 1);
+        close(fd);
+    }
+    free(users_file);
+    free(dir);
+}
+
+// Returns 1, if the repository still borrows objects from the mirror.
+static int uses_mirror(const char* repo_dir, const char* dir) {
+    char* alternates_file = NULL;
+    if (-1 == asprintf(&alternates_file, "%s/.git/objects/info/alternates", repo_dir)) {
+        die("Out of memory, asprintf failed");
+    }
+    char* alternates = read_file(alternates_file);
+    char* objects = path_join(dir, "objects");
+    // git writes the real path, while the cache directory may be reached via symlinks
+    char real_objects[PATH_MAX];
+    char real_line[PATH_MAX];
+    int ret = 0;
+    char* save = NULL;
+    if (realpath(objects, real_objects)) {
+        for (char* line = alternates ? strtok_r(alternates, "\n", &save) : NULL; line && !ret;
+                line = strtok_r(NULL, "\n", &save)) {
+            ret = !strcmp(line, objects) || (realpath(line, real_line) && !strcmp(real_line, real_objects));
+        }
+    }
+    free(objects);
+    free(alternates);
+    free(alternates_file);
+    return ret;
+}
+
+// Returns the number of distinct existing repositories, which borrow objects from the mirror.
+static int count_users(const char* dir) {
+    char* users_file = path_join(dir, USERS_FILE);
+    char* users = read_file(users_file);
+    struct list* seen = NULL;
+    int ret = 0;
+    char* save = NULL;
+    for (char* line = users ? strtok_r(users, "\n", &save) : NULL; line; line = strtok_r(NULL, "\n", &save)) {
+        int duplicate = 0;
+        for (struct list* l = seen; l && !duplicate; l = l->next) {
+            duplicate = !strcmp(line, (const char*)l->data);
+        }
+        if (!duplicate) {
+            seen = list_create(line, seen);
+            ret += uses_mirror(line, dir);
+        }
+    }
+    list_free(seen, NULL);
+    free(users);
+    free(users_file);
+    return ret;
+}
+
+int mirror_list(struct mirror_info** mirrors) {
+    assert(mirrors);
+
+    *mirrors = NULL;
+    char* root = user_cache_dir("mirrors");
+    DIR* d = opendir(root);
+    int count = 0;
+    int cap = 0;
+    struct dirent* e = NULL;
+    while (d && (e = readdir(d))) {
+        if ('.' == e->d_name[0] || !has_suffix(e->d_name, ".git")) {
+            continue;
+        }
+        char* dir = path_join(root, e->d_name);
+        struct stat st;
+        if (stat(dir, &st) || !S_ISDIR(st.st_mode)) {
+            free(dir);
+            continue;
+        }
+        if (count == cap) {
+            cap = cap ? 2 * cap : 16;
+            *mirrors = (struct mirror_info*)xrealloc(*mirrors, cap * sizeof(struct mirror_info));
+        }
+        struct mirror_info* m = *mirrors + count++;
+        char* url_file = path_join(dir, URL_FILE);
+        m->url = read_file(url_file);
+        if (m->url) {
+            m->url[strcspn(m->url, "\n")] = '\0';
+        }
+        free(url_file);
+        m->dir = dir;
+        m->size = tree_size(dir);
+        m->used = st.st_mtime;
+        m->users = count_users(dir);
+    }
+    if (d) {
+        closedir(d);
+    }
+    free(root);
+    return count;
+}
+
+void mirror_list_free(struct mirror_info* mirrors, int count) {
+    for (int i = 0; i < count; ++i) {
+        free(mirrors[i].dir);
+        free(mirrors[i].url);
+    }
+    free(mirrors);
+}
+
+int mirror_prune(int days) {
+    time_t now = time(NULL);
+    char* root = user_cache_dir("mirrors");
+    DIR* d = opendir(root);
+    struct dirent* e = NULL;
+    while (d && (e = readdir(d))) {
+        struct stat st;
+        char* path = path_join(root, e->d_name);
+        if (has_suffix(e->d_name, ".tmp") && !stat(path, &st) && st.st_mtime + STALE_TMP_SECONDS < now) {
+            remove_tree(path);
+        }
+        free(path);
+    }
+    if (d) {
+        closedir(d);
+    }
+    free(root);
+
+    struct mirror_info* mirrors = NULL;
+    int count = mirror_list(&mirrors);
+    int ret = 0;
+    for (int i = 0; i < count; ++i) {
+        if (!mirrors[i].users && mirrors[i].used + days * 24LL * 60 * 60 <= now && !remove_tree(mirrors[i].dir)) {
+            ++ret;
+        }
+    }
+    mirror_list_free(mirrors, count);
+    return ret;
+}
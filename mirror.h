@@ -0,0 +1,50 @@
+#ifndef MIRROR_H
+#define MIRROR_H
+
+#include "common.h"
+
+#include <time.h>
+
+// Local mirrors of Git repositories, shared by all workspaces of the user.
+//
+// A mirror is a bare 'git clone --mirror' of the repository, kept in $XDG_CACHE_HOME/agnostic/mirrors (or
+// ~/.cache/agnostic/mirrors) under a digest of the repository URL. 'ag clone --mirror' refreshes the mirror with
+// 'git fetch', and then clones with '--reference-if-able <mirror>', so that the new repository borrows objects from
+// the mirror via alternates instead of fetching and storing them again. Hence, refs are never pruned in a mirror, and
+// gc never prunes its objects. Repositories, which borrow from a mirror, are recorded in it, and a mirror is never
+// pruned while some of them still use it.
+
+struct mirror_info {
+    char* dir;
+    char* url;          // NULL, if unknown
+    long long size;     // in bytes
+    time_t used;        // last time the mirror was refreshed
+    int users;          // number of existing repositories, which borrow objects from the mirror
+};
+
+// Returns the directory of the mirror of the repository, which should be freed. The directory may not exist yet.
+char* mirror_dir(const char* url);
+
+// Returns the command line, which refreshes the mirror, or clones it, if it doesn't exist yet. A new mirror is
+// cloned into a temp directory, which is returned via 'tmp_dir' (or NULL there, if the mirror exists), and should be
+// passed to mirror_finish(). The returned string should be freed.
+char* mirror_update_cmdline(const char* url, char** tmp_dir);
+
+// Completes the update, which has succeeded, if 'ok' is 1: moves a new mirror into place, or removes it on failure,
+// and marks the mirror used. Returns 0, if the mirror is ready to use.
+int mirror_finish(const char* url, const char* tmp_dir, int ok);
+
+// Records that the repository in 'repo_dir' borrows objects from the mirror of the URL.
+void mirror_add_user(const char* url, const char* repo_dir);
+
+// Lists all mirrors. Returns their number, the array should be freed with mirror_list_free().
+int mirror_list(struct mirror_info** mirrors);
+
+// Frees the list of mirrors.
+void mirror_list_free(struct mirror_info* mirrors, int count);
+
+// Removes mirrors, which are not used by any repository, and haven't been refreshed for 'days' days. Also removes
+// leftovers of interrupted clones. Returns the number of removed mirrors.
+int mirror_prune(int days);
+
+#endif /* MIRROR_H */
@@ -0,0 +1,226 @@
+
+#include "pressure.h"
+#include "common.h"
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+enum pressure_totals {
+    T_CPU_SOME,
+    T_MEMORY_SOME,
+    T_MEMORY_FULL,
+    T_IO_SOME,
+
+    __t_length
+};
+
+struct pressure {
+    int max_jobs;
+    int limit;
+    int ncpu;
+    FILE* log;
+    long long last_sample_ms;
+    int has_totals;
+    unsigned long long totals[__t_length];
+    struct pressure_sample sample;
+    int deferred; // 1, if a deferral has already been logged since the last sample
+};
+
+// Reads 'some' and 'full' lines of the given PSI file. Returns 1 on success.
+static int read_psi_file(const char* file_name, double* some_avg10, unsigned long long* some_total,
+    double* full_avg10, unsigned long long* full_total) {
+
+    FILE* fh = fopen(file_name, "r");
+    if (!fh) {
+        return 0;
+    }
+    char line[256];
+    int ret = 0;
+    while (fgets(line, sizeof(line), fh)) {
+        double avg10 = 0;
+        unsigned long long total = 0;
+        if (2 == sscanf(line, "some avg10=%lf avg60=%*f avg300=%*f total=%llu", &avg10, &total)) {
+            *some_avg10 = avg10;
+            *some_total = total;
+            ret = 1;
+        } else if (full_avg10 && 2 == sscanf(line, "full avg10=%lf avg60=%*f avg300=%*f total=%llu", &avg10, &total)) {
+            *full_avg10 = avg10;
+            *full_total = total;
+        }
+    }
+    fclose(fh);
+    return ret;
+}
+
+static double stall_percent(unsigned long long now, unsigned long long prev, long long elapsed_ms) {
+    if (now < prev || 0 >= elapsed_ms) {
+        return 0;
+    }
+    double ret = (double)(now - prev) / (elapsed_ms * 10.0); // microseconds -> percents of elapsed time
+    return ret > 100.0 ? 100.0 : ret;
+}
+
+static void take_sample(struct pressure* p) {
+    long long now = now_ms();
+    long long elapsed = now - p->last_sample_ms;
+    struct pressure_sample* s = &p->sample;
+    memset(s, 0, sizeof(*s));
+
+    double avg[__t_length] = { 0 };
+    unsigned long long totals[__t_length] = { 0 };
+    s->has_psi = read_psi_file("/proc/pressure/cpu", avg + T_CPU_SOME, totals + T_CPU_SOME, NULL, NULL)
+        && read_psi_file("/proc/pressure/memory", avg + T_MEMORY_SOME, totals + T_MEMORY_SOME, avg + T_MEMORY_FULL, totals + T_MEMORY_FULL)
+        && read_psi_file("/proc/pressure/io", avg + T_IO_SOME, totals + T_IO_SOME, NULL, NULL);
+
+    if (s->has_psi) {
+        double pct[__t_length];
+        for (int i = 0; i < __t_length; ++i) {
+            pct[i] = p->has_totals ? stall_percent(totals[i], p->totals[i], elapsed) : avg[i];
+            p->totals[i] = totals[i];
+        }
+        p->has_totals = 1;
+        s->cpu_some = pct[T_CPU_SOME];
+        s->memory_some = pct[T_MEMORY_SOME];
+        s->memory_full = pct[T_MEMORY_FULL];
+        s->io_some = pct[T_IO_SOME];
+    }
+
+    FILE* fh = fopen("/proc/loadavg", "r");
+    if (fh) {
+        int total_tasks = 0;
+        s->has_loadavg = (3 == fscanf(fh, "%lf %*f %*f %d/%d", &s->load1, &s->runnable, &total_tasks));
+        fclose(fh);
+    }
+
+    p->last_sample_ms = now;
+}
+
+static void log_line(struct pressure* p, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+static void log_line(struct pressure* p, const char* format, ...) {
+    if (!p->log) {
+        return;
+    }
+    char stamp[32];
+    time_t t = time(NULL);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", localtime(&t));
+    fprintf(p->log, "%s ", stamp);
+    va_list vargs;
+    va_start(vargs, format);
+    vfprintf(p->log, format, vargs);
+    va_end(vargs);
+    fprintf(p->log, "\n");
+    fflush(p->log);
+}
+
+static void log_sample(struct pressure* p, const char* decision, int old_limit, int running) {
+    struct pressure_sample* s = &p->sample;
+    log_line(p, "%s limit %d -> %d running %d cpu %.1f mem %.1f/%.1f io %.1f load %.2f runnable %d/%d",
+        decision, old_limit, p->limit, running, s->cpu_some, s->memory_some, s->memory_full, s->io_some,
+        s->load1, s->runnable, p->ncpu);
+}
+
+struct pressure* pressure_create(int max_jobs, FILE* log) {
+    assert(0 < max_jobs);
+
+    struct pressure* p = (struct pressure*)xcalloc(1, sizeof(struct pressure));
+    p->max_jobs = max_jobs;
+    p->ncpu = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (1 > p->ncpu) {
+        p->ncpu = 1;
+    }
+    p->limit = p->ncpu < max_jobs ? p->ncpu : max_jobs;
+    p->log = log;
+    take_sample(p);
+    if (!p->sample.has_psi && !p->sample.has_loadavg) {
+        log_line(p, "no pressure information available, using fixed limit %d", p->limit);
+    } else {
+        log_sample(p, "start", p->limit, 0);
+    }
+    return p;
+}
+
+void pressure_free(struct pressure* p) {
+    free(p);
+}
+
+static int overloaded(struct pressure* p) {
+    struct pressure_sample* s = &p->sample;
+    if (s->has_psi && (s->cpu_some > PRESSURE_CPU_HIGH || s->memory_some > PRESSURE_MEMORY_HIGH
+            || s->io_some > PRESSURE_IO_HIGH)) {
+        return 1;
+    }
+    return s->has_loadavg && s->runnable > 2 * p->ncpu;
+}
+
+static int idle(struct pressure* p) {
+    struct pressure_sample* s = &p->sample;
+    if (s->has_psi && (s->cpu_some > PRESSURE_CPU_LOW || s->memory_some > PRESSURE_MEMORY_LOW
+            || s->io_some > PRESSURE_IO_LOW)) {
+        return 0;
+    }
+    if (s->has_loadavg && (s->runnable > p->ncpu || s->load1 > p->ncpu)) {
+        return 0;
+    }
+    return s->has_psi || s->has_loadavg;
+}
+
+void pressure_update(struct pressure* p, int running) {
+    assert(p);
+
+    if (0 < pressure_next_update_ms(p)) {
+        return;
+    }
+    take_sample(p);
+
+    int old_limit = p->limit;
+    if (p->sample.has_psi && p->sample.memory_full > PRESSURE_MEMORY_FULL_HIGH) {
+        // thrashing: back off fast
+        p->limit = p->limit / 2;
+        if (1 > p->limit) {
+            p->limit = 1;
+        }
+        log_sample(p, "thrashing", old_limit, running);
+    } else if (overloaded(p)) {
+        if (1 < p->limit) {
+            --p->limit;
+        }
+        log_sample(p, "overloaded", old_limit, running);
+    } else if (idle(p) && running >= p->limit && p->limit < p->max_jobs) {
+        ++p->limit;
+        log_sample(p, "idle", old_limit, running);
+    } else {
+        log_sample(p, "steady", old_limit, running);
+    }
+    p->deferred = 0;
+}
+
+int pressure_admit(struct pressure* p, int running, const char* name) {
+    assert(p);
+
+    if (running < p->limit) {
+        log_line(p, "admit %s running %d limit %d", name ? name : "", running + 1, p->limit);
+        return 1;
+    }
+    if (!p->deferred) {
+        log_line(p, "defer %s running %d limit %d", name ? name : "", running, p->limit);
+        p->deferred = 1;
+    }
+    return 0;
+}
+
+int pressure_limit(struct pressure* p) {
+    assert(p);
+    return p->limit;
+}
+
+int pressure_next_update_ms(struct pressure* p) {
+    assert(p);
+    long long left = p->last_sample_ms + PRESSURE_INTERVAL_MS - now_ms();
+    return 0 < left ? (int)left : 0;
+}
@@ -0,0 +1,60 @@
+#ifndef PRESSURE_H
+#define PRESSURE_H
+
+#include <stdio.h>
+
+// Adaptive admission controller. Decides, how many component scripts may run concurrently,
+// based on Linux pressure stall information (/proc/pressure/*) and load average.
+//
+// The controller keeps a concurrency limit between 1 and the given maximum. Each sampling interval it
+// lowers the limit, if the system is under pressure, and raises it, if the system is idle and the current
+// limit is fully used.
+
+// Sampling interval in milliseconds.
+#define PRESSURE_INTERVAL_MS 1000
+
+// Stall percentages (share of wall time, 0..100), above which the system is considered overloaded.
+#define PRESSURE_CPU_HIGH       50.0
+#define PRESSURE_MEMORY_HIGH    10.0
+#define PRESSURE_MEMORY_FULL_HIGH 2.0
+#define PRESSURE_IO_HIGH        40.0
+
+// Stall percentages, below which the system is considered idle enough to admit more jobs.
+#define PRESSURE_CPU_LOW        10.0
+#define PRESSURE_MEMORY_LOW     1.0
+#define PRESSURE_IO_LOW         15.0
+
+struct pressure_sample {
+    int has_psi;            // 1, if /proc/pressure is available
+    double cpu_some;        // percentage of time some tasks stalled on CPU
+    double memory_some;     // percentage of time some tasks stalled on memory
+    double memory_full;     // percentage of time all non-idle tasks stalled on memory
+    double io_some;         // percentage of time some tasks stalled on I/O
+    int has_loadavg;        // 1, if /proc/loadavg is available
+    double load1;           // 1 minute load average
+    int runnable;           // number of currently runnable tasks
+};
+
+struct pressure;
+
+// Creates a controller, which allows from 1 to max_jobs concurrent jobs.
+// If log is not NULL, all decisions are written to it. The log is not closed by pressure_free().
+struct pressure* pressure_create(int max_jobs, FILE* log);
+
+// Frees the controller.
+void pressure_free(struct pressure* p);
+
+// Takes a new sample and adjusts the limit, if the sampling interval has elapsed.
+// 'running' is the number of currently running jobs.
+void pressure_update(struct pressure* p, int running);
+
+// Returns 1, if a job with the given name may be started now, 0 otherwise.
+int pressure_admit(struct pressure* p, int running, const char* name);
+
+// Returns the current concurrency limit.
+int pressure_limit(struct pressure* p);
+
+// Returns the number of milliseconds until the next sample is due.
+int pressure_next_update_ms(struct pressure* p);
+
+#endif /* PRESSURE_H */
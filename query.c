@@ -0,0 +1,519 @@
+// for asprintf()
+#define _GNU_SOURCE
+
+#include "query.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <fnmatch.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint64_t qword;
+
+#define QWORD_BITS 64
+
+struct query_name {
+    const char* name;   // name or alias
+    int index;
+};
+
+struct query_graph {
+    int count;
+    int words;                      // number of words in a set
+    struct ag_component** comps;    // in the build order
+    qword* deps;                    // count sets: components, which each component is built after
+    qword* rdeps;                   // count sets: components, which are built after each component
+    struct query_name* names;       // sorted by name
+    int name_count;
+};
+
+enum token_type {
+    T_END,
+    T_WORD,
+    T_LPAREN,
+    T_RPAREN,
+    T_COMMA,
+    T_UNION,
+    T_INTERSECT,
+    T_EXCEPT
+};
+
+struct parser {
+    struct query_graph* g;
+    const char* text;
+    const char* p;
+    enum token_type tok;
+    char* word;         // text of the current T_WORD token
+    int quoted;         // 1, if the current word is quoted
+    int pos;            // position of the current token
+    char* error;
+};
+
+static const char* fields[] = {
+    "name", "alias", "description", "git", "hg", "build", "integrate", "clean", "test", "disabled", "buildAfter",
+    "outputs"
+};
+
+static int compare_names(const void* a, const void* b) {
+    return strcmp(((const struct query_name*)a)->name, ((const struct query_name*)b)->name);
+}
+
+struct query_graph* query_graph_create(struct ag_project* project) {
+    assert(project);
+
+    struct query_graph* g = (struct query_graph*)xcalloc(1, sizeof(struct query_graph));
+    struct list* order = ag_build_all_list(project);
+    for (struct list* i = order; i; i = i->next) {
+        ++g->count;
+    }
+    g->words = (g->count + QWORD_BITS - 1) / QWORD_BITS;
+    g->comps = (struct ag_component**)xcalloc(g->count ? g->count : 1, sizeof(struct ag_component*));
+    g->names = (struct query_name*)xcalloc(g->count ? 2 * g->count : 1, sizeof(struct query_name));
+    int n = 0;
+    for (struct list* i = order; i; i = i->next, ++n) {
+        struct ag_component* c = (struct ag_component*)i->data;
+        g->comps[n] = c;
+        g->names[g->name_count].name = c->name;
+        g->names[g->name_count++].index = n;
+        if (!empty(c->alias)) {
+            g->names[g->name_count].name = c->alias;
+            g->names[g->name_count++].index = n;
+        }
+    }
+    list_free(order, NULL);
+    qsort(g->names, g->name_count, sizeof(struct query_name), &compare_names);
+
+    g->deps = (qword*)xcalloc(g->count * g->words + 1, sizeof(qword));
+    g->rdeps = (qword*)xcalloc(g->count * g->words + 1, sizeof(qword));
+    for (int i = 0; i < g->count; ++i) {
+        for (struct list* b = g->comps[i]->build_after; b; b = b->next) {
+            struct query_name key = { (const char*)b->data, 0 };
+            struct query_name* dep = (struct query_name*)bsearch(&key, g->names, g->name_count,
+                sizeof(struct query_name), &compare_names);
+            if (dep) {
+                g->deps[i * g->words + dep->index / QWORD_BITS] |= (qword)1 << (dep->index % QWORD_BITS);
+                g->rdeps[dep->index * g->words + i / QWORD_BITS] |= (qword)1 << (i % QWORD_BITS);
+            }
+        }
+    }
+    return g;
+}
+
+void query_graph_free(struct query_graph* g) {
+    if (!g) {
+        return;
+    }
+    free(g->comps);
+    free(g->names);
+    free(g->deps);
+    free(g->rdeps);
+    free(g);
+}
+
+// Sets of components are bit sets of 'words' words, indexed by the build order.
+
+static qword* set_new(struct query_graph* g) {
+    return (qword*)xcalloc(g->words + 1, sizeof(qword));
+}
+
+static int set_has(const qword* s, int i) {
+    return 0 != (s[i / QWORD_BITS] & ((qword)1 << (i % QWORD_BITS)));
+}
+
+static void set_add(qword* s, int i) {
+    s[i / QWORD_BITS] |= (qword)1 << (i % QWORD_BITS);
+}
+
+static int set_empty(struct query_graph* g, const qword* s) {
+    for (int w = 0; w < g->words; ++w) {
+        if (s[w]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static qword* set_all(struct query_graph* g) {
+    qword* s = set_new(g);
+    for (int i = 0; i < g->count; ++i) {
+        set_add(s, i);
+    }
+    return s;
+}
+
+// Returns the set and everything reachable from it along 'edges' in up to 'depth' steps (any number, if negative).
+// Frees the set.
+static qword* closure(struct query_graph* g, const qword* edges, qword* s, int depth) {
+    qword* frontier = set_new(g);
+    memcpy(frontier, s, g->words * sizeof(qword));
+    qword* next = set_new(g);
+    for (int level = 0; (0 > depth || level < depth) && !set_empty(g, frontier); ++level) {
+        memset(next, 0, g->words * sizeof(qword));
+        for (int i = 0; i < g->count; ++i) {
+            if (set_has(frontier, i)) {
+                for (int w = 0; w < g->words; ++w) {
+                    next[w] |= edges[i * g->words + w];
+                }
+            }
+        }
+        for (int w = 0; w < g->words; ++w) {
+            next[w] &= ~s[w];
+            s[w] |= next[w];
+        }
+        qword* t = frontier;
+        frontier = next;
+        next = t;
+    }
+    free(frontier);
+    free(next);
+    return s;
+}
+
+// Returns components of the shortest path from some component of 'from' to some component of 'to' along buildAfter
+// edges, or an empty set, if there's none. Frees both sets.
+static qword* some_path(struct query_graph* g, qword* from, qword* to) {
+    int* parent = (int*)xcalloc(g->count ? g->count : 1, sizeof(int));
+    int* queue = (int*)xcalloc(g->count ? g->count : 1, sizeof(int));
+    qword* seen = set_new(g);
+    int head = 0;
+    int tail = 0;
+    for (int i = 0; i < g->count; ++i) {
+        if (set_has(from, i)) {
+            parent[i] = -1;
+            set_add(seen, i);
+            queue[tail++] = i;
+        }
+    }
+    int found = -1;
+    while (head < tail && -1 == found) {
+        int i = queue[head++];
+        if (set_has(to, i)) {
+            found = i;
+            break;
+        }
+        for (int j = 0; j < g->count; ++j) {
+            if (set_has(g->deps + i * g->words, j) && !set_has(seen, j)) {
+                parent[j] = i;
+                set_add(seen, j);
+                queue[tail++] = j;
+            }
+        }
+    }
+    qword* ret = set_new(g);
+    for (int i = found; -1 != i; i = parent[i]) {
+        set_add(ret, i);
+    }
+    free(parent);
+    free(queue);
+    free(seen);
+    free(from);
+    free(to);
+    return ret;
+}
+
+static int find_field(const char* field) {
+    for (int i = 0; i < ARRAY_SIZE(fields); ++i) {
+        if (!strcmp(fields[i], field)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Returns 1, if some value of the field matches the pattern, or, if pattern is NULL, if the field is set.
+static int field_matches(struct ag_component* c, const char* field, const char* pattern) {
+    const char* value = NULL;
+    struct list* values = NULL;
+    if (!strcmp("name", field)) {
+        value = c->name;
+    } else if (!strcmp("alias", field)) {
+        value = c->alias;
+    } else if (!strcmp("description", field)) {
+        value = c->description;
+    } else if (!strcmp("git", field)) {
+        value = c->git;
+    } else if (!strcmp("hg", field)) {
+        value = c->hg;
+    } else if (!strcmp("build", field)) {
+        value = c->build;
+    } else if (!strcmp("integrate", field)) {
+        value = c->integrate;
+    } else if (!strcmp("clean", field)) {
+        value = c->clean;
+    } else if (!strcmp("test", field)) {
+        value = c->test;
+    } else if (!strcmp("disabled", field)) {
+        value = c->disabled ? "true" : (pattern ? "false" : NULL);
+    } else if (!strcmp("buildAfter", field)) {
+        values = c->build_after;
+    } else if (!strcmp("outputs", field)) {
+        values = c->outputs;
+    }
+    if (!values) {
+        return !empty(value) && (!pattern || !fnmatch(pattern, value, 0));
+    }
+    for (struct list* i = values; i; i = i->next) {
+        if (!pattern || !fnmatch(pattern, (const char*)i->data, 0)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Returns the components of the set, for which the field matches the pattern (see field_matches()). Frees the set.
+static qword* filter_field(struct query_graph* g, qword* s, const char* field, const char* pattern) {
+    for (int i = 0; i < g->count; ++i) {
+        if (set_has(s, i) && !field_matches(g->comps[i], field, pattern)) {
+            s[i / QWORD_BITS] &= ~((qword)1 << (i % QWORD_BITS));
+        }
+    }
+    return s;
+}
+
+// Records the error at the given position of the query, unless there's an earlier one.
+static void fail_at(struct parser* p, int pos, const char* format, const char* arg) {
+    if (p->error) {
+        return;
+    }
+    char* msg = NULL;
+    if (-1 == asprintf(&msg, format, arg) || -1 == asprintf(&p->error, "%s at position %d", msg, pos + 1)) {
+        die("Out of memory, asprintf failed");
+    }
+    free(msg);
+}
+
+// Records the error at the current token.
+static void fail(struct parser* p, const char* format, const char* arg) {
+    fail_at(p, p->pos, format, arg);
+}
+
+static int is_word_char(char ch) {
+    return ch && !isspace((unsigned char)ch) && !strchr("(),+^\"", ch);
+}
+
+// Reads the next token.
+static void advance(struct parser* p) {
+    free(p->word);
+    p->word = NULL;
+    p->quoted = 0;
+    while (isspace((unsigned char)*p->p)) {
+        ++p->p;
+    }
+    p->pos = p->p - p->text;
+    char ch = *p->p;
+    const char* single = ch ? strchr("(),+^-", ch) : NULL;
+    if (!ch) {
+        p->tok = T_END;
+    } else if (single) {
+        // '-' is a part of a name, unless it starts a token
+        enum token_type types[] = { T_LPAREN, T_RPAREN, T_COMMA, T_UNION, T_INTERSECT, T_EXCEPT };
+        p->tok = types[single - "(),+^-"];
+        ++p->p;
+    } else if ('"' == ch) {
+        const char* end = strchr(p->p + 1, '"');
+        if (!end) {
+            fail(p, "Unterminated quote%s", "");
+            p->tok = T_END;
+            return;
+        }
+        p->tok = T_WORD;
+        p->word = strndup(p->p + 1, end - p->p - 1);
+        p->quoted = 1;
+        p->p = end + 1;
+    } else {
+        const char* start = p->p;
+        while (is_word_char(*p->p)) {
+            ++p->p;
+        }
+        p->tok = T_WORD;
+        p->word = strndup(start, p->p - start);
+        if (!strcmp("union", p->word)) {
+            p->tok = T_UNION;
+        } else if (!strcmp("intersect", p->word)) {
+            p->tok = T_INTERSECT;
+        } else if (!strcmp("except", p->word)) {
+            p->tok = T_EXCEPT;
+        }
+    }
+}
+
+static void expect(struct parser* p, enum token_type tok, const char* what) {
+    if (tok != p->tok) {
+        fail(p, "Expected %s", what);
+    } else {
+        advance(p);
+    }
+}
+
+// Reads a word argument. Returns a copy of the word, which should be freed, or NULL on error.
+static char* word_arg(struct parser* p, const char* what) {
+    if (T_WORD != p->tok) {
+        fail(p, "Expected %s", what);
+        return NULL;
+    }
+    char* ret = xstrdup(p->word);
+    advance(p);
+    return ret;
+}
+
+// Reads a field name argument, followed by a comma.
+static char* field_arg(struct parser* p) {
+    int pos = p->pos;
+    char* field = word_arg(p, "field name");
+    if (field && -1 == find_field(field)) {
+        fail_at(p, pos, "Unknown field '%s'", field);
+    }
+    expect(p, T_COMMA, "','");
+    return field;
+}
+
+static qword* parse_expr(struct parser* p);
+
+// Reads optional ", <depth>" of deps() and rdeps(). Returns -1, if there's none.
+static int depth_arg(struct parser* p) {
+    if (T_COMMA != p->tok) {
+        return -1;
+    }
+    advance(p);
+    char* end = NULL;
+    long depth = (T_WORD == p->tok) ? strtol(p->word, &end, 10) : -1;
+    if (T_WORD != p->tok || *end || !*p->word || 0 > depth) {
+        fail(p, "Expected depth%s", "");
+        return -1;
+    }
+    advance(p);
+    return (int)depth;
+}
+
+// Parses arguments of the function, which name is at 'pos', the opening parenthesis is already read.
+static qword* parse_call(struct parser* p, const char* fn, int pos) {
+    struct query_graph* g = p->g;
+    qword* ret = NULL;
+    if (!strcmp("deps", fn) || !strcmp("rdeps", fn)) {
+        qword* s = parse_expr(p);
+        int depth = depth_arg(p);
+        ret = closure(g, 'd' == fn[0] ? g->deps : g->rdeps, s, depth);
+    } else if (!strcmp("somepath", fn) || !strcmp("allpaths", fn)) {
+        qword* from = parse_expr(p);
+        expect(p, T_COMMA, "','");
+        qword* to = parse_expr(p);
+        if ('s' == fn[0]) {
+            ret = some_path(g, from, to);
+        } else {
+            // components, which are reachable from 'from', and from which 'to' is reachable
+            ret = closure(g, g->deps, from, -1);
+            qword* up = closure(g, g->rdeps, to, -1);
+            for (int w = 0; w < g->words; ++w) {
+                ret[w] &= up[w];
+            }
+            free(up);
+        }
+    } else if (!strcmp("has", fn)) {
+        char* field = field_arg(p);
+        qword* s = parse_expr(p);
+        ret = p->error ? s : filter_field(g, s, field, NULL);
+        free(field);
+    } else if (!strcmp("attr", fn)) {
+        char* field = field_arg(p);
+        char* pattern = word_arg(p, "pattern");
+        expect(p, T_COMMA, "','");
+        qword* s = parse_expr(p);
+        ret = p->error ? s : filter_field(g, s, field, pattern);
+        free(field);
+        free(pattern);
+    } else if (!strcmp("filter", fn)) {
+        char* pattern = word_arg(p, "pattern");
+        expect(p, T_COMMA, "','");
+        qword* s = parse_expr(p);
+        ret = p->error ? s : filter_field(g, s, "name", pattern);
+        free(pattern);
+    } else {
+        fail_at(p, pos, "Unknown function '%s'", fn);
+        ret = set_new(g);
+    }
+    expect(p, T_RPAREN, "')'");
+    return ret;
+}
+
+static qword* parse_term(struct parser* p) {
+    struct query_graph* g = p->g;
+    if (T_LPAREN == p->tok) {
+        advance(p);
+        qword* ret = parse_expr(p);
+        expect(p, T_RPAREN, "')'");
+        return ret;
+    }
+    if (T_WORD != p->tok) {
+        fail(p, "Expected component name, 'all', function or '('%s", "");
+        return set_new(g);
+    }
+    char* word = xstrdup(p->word);
+    int quoted = p->quoted;
+    int pos = p->pos;
+    advance(p);
+    qword* ret = NULL;
+    if (!quoted && T_LPAREN == p->tok) {
+        advance(p);
+        ret = parse_call(p, word, pos);
+    } else if (!quoted && !strcmp("all", word)) {
+        ret = set_all(g);
+    } else {
+        ret = set_new(g);
+        struct query_name key = { word, 0 };
+        struct query_name* found = (struct query_name*)bsearch(&key, g->names, g->name_count,
+            sizeof(struct query_name), &compare_names);
+        if (found) {
+            set_add(ret, found->index);
+        } else {
+            fail_at(p, pos, "Component not found: %s", word);
+        }
+    }
+    free(word);
+    return ret;
+}
+
+static qword* parse_expr(struct parser* p) {
+    struct query_graph* g = p->g;
+    qword* left = parse_term(p);
+    while (!p->error && (T_UNION == p->tok || T_INTERSECT == p->tok || T_EXCEPT == p->tok)) {
+        enum token_type op = p->tok;
+        advance(p);
+        qword* right = parse_term(p);
+        for (int w = 0; w < g->words; ++w) {
+            left[w] = (T_UNION == op) ? (left[w] | right[w])
+                : (T_INTERSECT == op) ? (left[w] & right[w]) : (left[w] & ~right[w]);
+        }
+        free(right);
+    }
+    return left;
+}
+
+int query_eval(struct query_graph* g, const char* query, struct list** result, char** error) {
+    assert(g);
+    assert(query);
+    assert(result);
+    assert(error);
+
+    struct parser p = { g, query, query, T_END, NULL, 0, 0, NULL };
+    advance(&p);
+    qword* s = parse_expr(&p);
+    if (T_END != p.tok) {
+        fail(&p, p.word ? "Unexpected '%s'" : "Unexpected token%s", p.word ? p.word : "");
+    }
+    free(p.word);
+    *result = NULL;
+    *error = p.error;
+    if (!p.error) {
+        struct list* tail = NULL;
+        for (int i = 0; i < g->count; ++i) {
+            if (set_has(s, i)) {
+                list_add(result, &tail, g->comps[i]);
+            }
+        }
+    }
+    free(s);
+    return p.error ? -1 : 0;
+}
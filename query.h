@@ -0,0 +1,40 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include "agnostic.h"
+
+// Queries of the component graph. The graph is indexed once (components are numbered in the build order, edges are
+// kept as bit sets), then any number of queries is evaluated against it. The language is:
+//
+//   <name>                      the component with the given name or alias
+//   all                         all components
+//   deps(<q> [, <depth>])       components of <q> and everything they're built after (up to <depth> levels)
+//   rdeps(<q> [, <depth>])      components of <q> and everything built after them (up to <depth> levels)
+//   somepath(<from>, <to>)      components of some path from a component of <from> to one of <to> along buildAfter
+//   allpaths(<from>, <to>)      components of all such paths
+//   has(<field>, <q>)           components of <q>, which have the field set
+//   attr(<field>, <glob>, <q>)  components of <q>, which have a field value matching the glob pattern
+//   filter(<glob>, <q>)         components of <q>, which names match the glob pattern
+//   <q> + <q>, <q> union <q>    union
+//   <q> ^ <q>, <q> intersect <q> intersection
+//   <q> - <q>, <q> except <q>   difference
+//   (<q>)
+//
+// Binary operators have the same precedence and are left-associative. Names and patterns may be quoted with double
+// quotes. Fields are name, alias, description, git, hg, build, integrate, clean, test, disabled ("true" or "false"),
+// buildAfter and outputs (matched by any of their values).
+
+struct query_graph;
+
+// Indexes the components of the project.
+struct query_graph* query_graph_create(struct ag_project* project);
+
+// Frees the graph.
+void query_graph_free(struct query_graph* g);
+
+// Evaluates the query. On success, returns 0 and sets 'result' to the list of matching components in the build
+// order, which should be freed with list_free(list, NULL). On failure, returns -1 and sets 'error' to the
+// description of the problem, which should be freed.
+int query_eval(struct query_graph* g, const char* query, struct list** result, char** error);
+
+#endif /* QUERY_H */
@@ -0,0 +1,381 @@
+
+#include "scheduler.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Self-pipe, which wakes up the scheduler loop on SIGCHLD and interrupts.
+static int sigchld_pipe[2] = { -1, -1 };
+
+// Number of interrupting signals received, and the last of them.
+static volatile sig_atomic_t interrupts = 0;
+static volatile sig_atomic_t interrupt_sig = 0;
+
+static const int interrupt_signals[] = { SIGINT, SIGTERM, SIGHUP };
+#define INTERRUPT_SIGNAL_COUNT (sizeof(interrupt_signals) / sizeof(interrupt_signals[0]))
+
+static void on_sigchld(int sig) {
+    int saved_errno = errno;
+    if (-1 != sigchld_pipe[1]) {
+        write(sigchld_pipe[1], "c", 1);
+    }
+    errno = saved_errno;
+}
+
+static void on_interrupt(int sig) {
+    interrupt_sig = sig;
+    ++interrupts;
+    on_sigchld(sig);
+}
+
+// Creates a pipe with both ends close-on-exec. Returns 0 on success.
+static int cloexec_pipe(int fds[2], int nonblock) {
+    if (pipe(fds)) {
+        return -1;
+    }
+    for (int i = 0; i < 2; ++i) {
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+        if (nonblock) {
+            fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+        }
+    }
+    return 0;
+}
+
+struct scheduler* sched_create(int job_count, sched_start_fn start, sched_finish_fn finish, void* ctx) {
+    assert(0 <= job_count);
+    assert(start);
+    assert(finish);
+
+    struct scheduler* s = (struct scheduler*)xcalloc(1, sizeof(struct scheduler));
+    s->jobs = (struct sched_job*)xcalloc(job_count ? job_count : 1, sizeof(struct sched_job));
+    s->job_count = job_count;
+    s->max_jobs = 1;
+    s->stop_on_failure = 1;
+    s->start = start;
+    s->finish = finish;
+    s->ctx = ctx;
+    for (int i = 0; i < job_count; ++i) {
+        s->jobs[i].output_fd = -1;
+    }
+    return s;
+}
+
+void sched_free(struct scheduler* s) {
+    if (!s) {
+        return;
+    }
+    for (int i = 0; i < s->job_count; ++i) {
+        list_free(s->jobs[i].dependents, NULL);
+        buffer_free(&s->jobs[i].output);
+    }
+    free(s->jobs);
+    free(s);
+}
+
+void sched_depend(struct scheduler* s, int job, int on) {
+    assert(s);
+    assert(0 <= job && job < s->job_count);
+    assert(0 <= on && on < s->job_count);
+
+    if (job == on) {
+        return;
+    }
+    s->jobs[job].waiting_for++;
+    s->jobs[on].dependents = list_create(s->jobs + job, s->jobs[on].dependents);
+}
+
+// Reads all available output of the job. Closes the pipe on EOF or error.
+static void read_output(struct scheduler* s, struct sched_job* job) {
+    char buf[4096];
+    while (-1 != job->output_fd) {
+        ssize_t n = read(job->output_fd, buf, sizeof(buf));
+        if (0 < n) {
+            job->last_output = now_ms();
+            buffer_append(&job->output, buf, n);
+            if (s->echo) {
+                fwrite(buf, 1, n, stdout);
+                fflush(stdout);
+            }
+        } else if (0 > n && EINTR == errno) {
+            continue;
+        } else {
+            if (0 == n || EAGAIN != errno) {
+                close(job->output_fd);
+                job->output_fd = -1;
+            }
+            break;
+        }
+    }
+}
+
+static int complete(struct scheduler* s, struct sched_job* job) {
+    if (-1 != job->output_fd) {
+        // the child has exited, so everything it has written is already in the pipe
+        read_output(s, job);
+        if (-1 != job->output_fd) {
+            close(job->output_fd);
+            job->output_fd = -1;
+        }
+    }
+    int rc = s->finish(s, job);
+    job->state = rc ? JOB_FAILED : JOB_DONE;
+    buffer_free(&job->output);
+    for (struct list* l = job->dependents; l; l = l->next) {
+        ((struct sched_job*)l->data)->waiting_for--;
+    }
+    return rc;
+}
+
+// Starts the job. Returns 1, if the job is running, 0, if it has been completed immediately.
+static int start(struct scheduler* s, struct sched_job* job, int* failed) {
+    int pipefd[2] = { -1, -1 };
+    if (s->capture && cloexec_pipe(pipefd, 0)) {
+        perror(NULL);
+        die("Unable to create pipe");
+    }
+    pid_t pid = s->start(s, job, pipefd[1]);
+    if (-1 != pipefd[1]) {
+        close(pipefd[1]);
+    }
+    if (0 < pid) {
+        job->state = JOB_RUNNING;
+        job->pid = pid;
+        job->started = now_ms();
+        job->last_output = job->started;
+        job->output_fd = pipefd[0];
+        if (-1 != job->output_fd) {
+            fcntl(job->output_fd, F_SETFL, fcntl(job->output_fd, F_GETFL) | O_NONBLOCK);
+        }
+        return 1;
+    }
+    if (-1 != pipefd[0]) {
+        close(pipefd[0]);
+    }
+    if (0 > pid) {
+        job->status = W_EXITCODE(127, 0);
+    }
+    if (complete(s, job)) {
+        ++*failed;
+    }
+    return 0;
+}
+
+// Sends the signal to the process group of the job, or to the job's process, if it isn't a group leader.
+static void signal_job(struct sched_job* job, int sig) {
+    if (kill(-job->pid, sig) && ESRCH == errno) {
+        kill(job->pid, sig);
+    }
+}
+
+// Starts killing the job, if it hasn't been killed yet.
+static void kill_job(struct sched_job* job, enum sched_kill_reason reason, long long now) {
+    if (KILL_NONE != job->killed) {
+        return;
+    }
+    job->killed = reason;
+    job->kill_at = now + SCHED_KILL_GRACE_MS;
+    signal_job(job, SIGTERM);
+}
+
+// Kills jobs, which are out of time, and escalates to SIGKILL, where the grace period is over. Returns the number of
+// milliseconds until the next deadline, or -1, if there's none.
+static int check_deadlines(struct scheduler* s, long long now) {
+    long long next = -1;
+    for (int i = 0; i < s->job_count; ++i) {
+        struct sched_job* job = s->jobs + i;
+        if (JOB_RUNNING != job->state) {
+            continue;
+        }
+        if (job->timeout_ms && now >= job->started + job->timeout_ms) {
+            kill_job(job, KILL_TIMEOUT, now);
+        } else if (job->stall_ms && -1 != job->output_fd && now >= job->last_output + job->stall_ms) {
+            kill_job(job, KILL_STALL, now);
+        }
+        long long deadline = -1;
+        if (job->kill_at) {
+            if (now >= job->kill_at) {
+                signal_job(job, SIGKILL);
+                job->kill_at = 0;
+            } else {
+                deadline = job->kill_at;
+            }
+        } else if (KILL_NONE == job->killed) {
+            if (job->timeout_ms) {
+                deadline = job->started + job->timeout_ms;
+            }
+            if (job->stall_ms && -1 != job->output_fd
+                    && (-1 == deadline || job->last_output + job->stall_ms < deadline)) {
+                deadline = job->last_output + job->stall_ms;
+            }
+        }
+        if (-1 != deadline && (-1 == next || deadline < next)) {
+            next = deadline;
+        }
+    }
+    return -1 == next ? -1 : (int)(next - now);
+}
+
+static int may_start(struct scheduler* s, struct sched_job* job, int running) {
+    if (s->pressure) {
+        return pressure_admit(s->pressure, running, job->name);
+    }
+    return running < s->max_jobs;
+}
+
+int sched_run(struct scheduler* s) {
+    assert(s);
+    assert(0 < s->max_jobs);
+
+    if (cloexec_pipe(sigchld_pipe, 1)) {
+        perror(NULL);
+        die("Unable to create pipe");
+    }
+    struct sigaction sa;
+    struct sigaction old_sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &on_sigchld;
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, &old_sa);
+
+    struct sigaction old_interrupt_sa[INTERRUPT_SIGNAL_COUNT];
+    interrupts = 0;
+    sa.sa_handler = &on_interrupt;
+    sa.sa_flags = SA_RESTART;
+    for (size_t i = 0; i < INTERRUPT_SIGNAL_COUNT; ++i) {
+        sigaction(interrupt_signals[i], &sa, old_interrupt_sa + i);
+    }
+    int handled_interrupts = 0;
+
+    struct pollfd* fds = (struct pollfd*)xcalloc(s->job_count + 1, sizeof(struct pollfd));
+    struct sched_job** fd_jobs = (struct sched_job**)xcalloc(s->job_count + 1, sizeof(struct sched_job*));
+
+    int running = 0;
+    int failed = 0;
+    while (1) {
+        if (s->pressure) {
+            pressure_update(s->pressure, running);
+        }
+
+        int progress = 1;
+        while (progress) {
+            progress = 0;
+            for (int i = 0; i < s->job_count && !(failed && s->stop_on_failure) && !interrupts; ++i) {
+                struct sched_job* job = s->jobs + i;
+                if (JOB_PENDING != job->state || job->waiting_for) {
+                    continue;
+                }
+                if (!may_start(s, job, running)) {
+                    break;
+                }
+                if (start(s, job, &failed)) {
+                    ++running;
+                } else {
+                    // dependents of the completed job may have become ready
+                    progress = 1;
+                }
+            }
+        }
+
+        if (0 == running) {
+            break;
+        }
+
+        int nfds = 0;
+        fds[nfds].fd = sigchld_pipe[0];
+        fds[nfds].events = POLLIN;
+        fd_jobs[nfds++] = NULL;
+        for (int i = 0; i < s->job_count; ++i) {
+            struct sched_job* job = s->jobs + i;
+            if (JOB_RUNNING == job->state && -1 != job->output_fd) {
+                fds[nfds].fd = job->output_fd;
+                fds[nfds].events = POLLIN;
+                fd_jobs[nfds++] = job;
+            }
+        }
+        int timeout = check_deadlines(s, now_ms());
+        if (s->pressure) {
+            int pressure_timeout = pressure_next_update_ms(s->pressure);
+            timeout = (-1 == timeout || pressure_timeout < timeout) ? pressure_timeout : timeout;
+        }
+        if (0 > poll(fds, nfds, timeout) && EINTR != errno) {
+            perror(NULL);
+            die("Failed to wait for jobs");
+        }
+
+        char buf[64];
+        while (0 < read(sigchld_pipe[0], buf, sizeof(buf))) {
+        }
+        if (handled_interrupts != interrupts) {
+            // the first interrupt terminates running jobs, the next one kills them
+            long long now = now_ms();
+            for (int i = 0; i < s->job_count; ++i) {
+                struct sched_job* job = s->jobs + i;
+                if (JOB_RUNNING != job->state) {
+                    continue;
+                }
+                if (handled_interrupts) {
+                    signal_job(job, SIGKILL);
+                    job->kill_at = 0;
+                } else {
+                    kill_job(job, KILL_INTERRUPT, now);
+                }
+            }
+            handled_interrupts = interrupts;
+        }
+        for (int i = 1; i < nfds; ++i) {
+            if (fds[i].revents) {
+                read_output(s, fd_jobs[i]);
+            }
+        }
+
+        for (int i = 0; i < s->job_count; ++i) {
+            struct sched_job* job = s->jobs + i;
+            if (JOB_RUNNING != job->state) {
+                continue;
+            }
+            int status = 0;
+            pid_t pid = waitpid(job->pid, &status, WNOHANG);
+            if (0 == pid || (0 > pid && EINTR == errno)) {
+                continue;
+            }
+            job->status = (0 < pid) ? status : W_EXITCODE(127, 0);
+            --running;
+            if (complete(s, job)) {
+                ++failed;
+            }
+        }
+    }
+
+    for (int i = 0; i < s->job_count; ++i) {
+        if (JOB_PENDING == s->jobs[i].state) {
+            s->jobs[i].state = JOB_CANCELLED;
+        }
+    }
+
+    free(fds);
+    free(fd_jobs);
+    sigaction(SIGCHLD, &old_sa, NULL);
+    for (size_t i = 0; i < INTERRUPT_SIGNAL_COUNT; ++i) {
+        sigaction(interrupt_signals[i], old_interrupt_sa + i, NULL);
+    }
+    close(sigchld_pipe[0]);
+    close(sigchld_pipe[1]);
+    sigchld_pipe[0] = -1;
+    sigchld_pipe[1] = -1;
+    if (interrupts) {
+        // all jobs are gone, so let the interrupt take its usual effect
+        fflush(stdout);
+        raise(interrupt_sig);
+    }
+    return failed;
+}
@@ -0,0 +1,86 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "common.h"
+#include "pressure.h"
+
+// Runs a set of jobs as child processes, with bounded concurrency and respecting dependencies between jobs.
+
+enum sched_job_state {
+    JOB_PENDING,
+    JOB_RUNNING,
+    JOB_DONE,
+    JOB_FAILED,
+    JOB_CANCELLED
+};
+
+// Reason, for which the scheduler has killed a job.
+enum sched_kill_reason {
+    KILL_NONE,
+    KILL_TIMEOUT,       // the job has been running longer than its timeout
+    KILL_STALL,         // the job hasn't written any output for its stall timeout
+    KILL_INTERRUPT      // the scheduler has been interrupted by a signal
+};
+
+struct sched_job {
+    const char* name;           // used for logging only
+    void* data;                 // user data
+    enum sched_job_state state;
+    pid_t pid;
+    int status;                 // status of the finished child process, as returned by wait()
+    int output_fd;              // read end of the output pipe, or -1
+    struct buffer output;       // captured output, if capturing is on
+    int waiting_for;            // number of unfinished dependencies
+    struct list* dependents;    // list of sched_job, which depend on this one
+    long long timeout_ms;       // if not 0, the job is killed after running for this long
+    long long stall_ms;         // if not 0, the job is killed after writing no output for this long (needs capture)
+    enum sched_kill_reason killed;  // why the job has been killed, if it has
+    long long started;          // start time of the job (now_ms())
+    long long last_output;      // time of the last output of the job
+    long long kill_at;          // time to send SIGKILL, if the job ignores SIGTERM, or 0
+};
+
+struct scheduler;
+
+// Time, which a job is given to exit after SIGTERM, before it's killed with SIGKILL.
+#define SCHED_KILL_GRACE_MS 2000
+
+// Starts the job. 'output_fd' is the write end of the output pipe, or -1, if output is not captured.
+// If the child process is a process group leader, signals are sent to the whole group.
+// Returns child process PID. Returns 0, if the job has been completed without starting a process (in this case,
+// job->status should be set). Returns -1 on failure.
+typedef pid_t (*sched_start_fn)(struct scheduler* s, struct sched_job* job, int output_fd);
+
+// Called, when the job is completed. Returns 0, if the job succeeded, and non-zero otherwise.
+typedef int (*sched_finish_fn)(struct scheduler* s, struct sched_job* job);
+
+struct scheduler {
+    struct sched_job* jobs;
+    int job_count;
+    int max_jobs;               // concurrency limit
+    struct pressure* pressure;  // if not NULL, concurrency is limited adaptively (up to max_jobs)
+    int capture;                // if 1, job output is captured into job->output
+    int echo;                   // if 1, captured output is also copied to stdout as it arrives (for serial runs)
+    int stop_on_failure;        // if 1, no new jobs are started after the first failure
+    sched_start_fn start;
+    sched_finish_fn finish;
+    void* ctx;                  // user data
+};
+
+// Creates a scheduler for the given number of jobs. The jobs should be filled in by the caller.
+struct scheduler* sched_create(int job_count, sched_start_fn start, sched_finish_fn finish, void* ctx);
+
+// Frees the scheduler. Does not free job data.
+void sched_free(struct scheduler* s);
+
+// Makes job with index 'job' wait for job with index 'on'.
+void sched_depend(struct scheduler* s, int job, int on);
+
+// Runs all jobs. Ready jobs are started in the order of their indices.
+// Returns the number of failed jobs. Jobs, which have not been started due to failures, are marked JOB_CANCELLED.
+// Jobs, which run out of time, are sent SIGTERM, and then SIGKILL, if they don't exit within SCHED_KILL_GRACE_MS.
+// On SIGINT, SIGTERM or SIGHUP, all running jobs are killed the same way (a repeated signal kills them at once), and
+// after they have been completed, the signal is raised again with its previous disposition.
+int sched_run(struct scheduler* s);
+
+#endif /* SCHEDULER_H */
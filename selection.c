@@ -0,0 +1,107 @@
+#include "selection.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static struct ag_component* extract_component(struct ag_project* project, int argc, const char** argv) {
+    struct ag_component* ret = NULL;
+    if (1 == argc) {
+        ret = ag_find_component(project, *argv);
+    } else if (2 == argc) {
+        if (!strcmp("-c", *argv)) {
+            ret = ag_find_component(project, *(argv+1));
+        } else {
+            die("Unrecognized argument: %s", *argv);
+        }
+    } else if (0 == argc) {
+        ret = ag_find_current_component(project);
+    } else {
+        die("Too many arguments");
+    }
+    if (!ret) {
+        die("Component not found");
+    }
+    return ret;
+}
+
+static struct list* list_current(struct ag_project* project) {
+    return list_create(extract_component(project, 0, NULL), NULL);
+}
+
+static struct list* list_list(struct ag_project* project, int argc, const char** argv) {
+    struct list* ret = NULL;
+    struct list* tail = NULL;
+    while (0 < argc) {
+        struct ag_component* c = ag_find_component(project, *argv);
+        // TODO: re-write this to support -c and use extract_component()
+        if (!c) {
+            die("Component not found: %s", *argv);
+        }
+        --argc;
+        ++argv;
+        list_add(&ret, &tail, c);
+    }
+    return ret;
+}
+
+static struct list* list_up_down(struct ag_project* project, int up, int* skip_disabled, int argc, const char** argv) {
+    const char* up_to = NULL;
+
+    while (1 <= argc) {
+        if (!strcmp("-t", *argv) || !strcmp("--to", *argv)) {
+            if (2 > argc) {
+                die("Expected component name/alias after %s", *argv);
+            }
+            ++argv;
+            --argc;
+            up_to = *argv;
+        } else {
+            break;
+        }
+        ++argv;
+        --argc;
+    }
+    *skip_disabled = (NULL == up_to);
+
+    struct list* ret = NULL;
+    int rc = 0;
+    if (up) {
+        ret = ag_build_up_list(project, extract_component(project, argc, argv), up_to, &rc);
+    } else {
+        ret = ag_build_down_list(project, extract_component(project, argc, argv), up_to, &rc);
+    }
+    if (!ret) {
+        die("Failed to resolve build order. %s.", ag_error_msg(rc));
+    }
+    return ret;
+}
+
+static struct list* list_all(struct ag_project* project) {
+    return ag_build_all_list(project);
+}
+
+int is_selection_keyword(const char* arg) {
+    return !strcmp("up", arg) || !strcmp("down", arg) || !strcmp("all", arg);
+}
+
+struct list* select_components(struct ag_project* project, int argc, const char** argv, int* skip_disabled) {
+    assert(project);
+    assert(skip_disabled);
+
+    *skip_disabled = 0;
+    if (0 == argc) {
+        return list_current(project);
+    }
+    if (!strcmp("up", *argv)) {
+        return list_up_down(project, 1, skip_disabled, argc-1, argv+1);
+    }
+    if (!strcmp("down", *argv)) {
+        return list_up_down(project, 0, skip_disabled, argc-1, argv+1);
+    }
+    if (!strcmp("all", *argv)) {
+        *skip_disabled = 1;
+        return list_all(project);
+    }
+    return list_list(project, argc, argv);
+}
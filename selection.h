@@ -0,0 +1,25 @@
+#ifndef SELECTION_H
+#define SELECTION_H
+
+#include "agnostic.h"
+
+// Selection of components by command line arguments, which is shared by all commands working with sets of
+// components. Supported forms are:
+//
+//   (no arguments)                      the current component
+//   up [-t <component>] [[-c] <name>]   the component and everything it's built after (up to the -t component)
+//   down [-t <component>] [[-c] <name>] the component and everything built after it (up to the -t component)
+//   all                                 all components
+//   <name>...                           the given components
+//
+// Components are named by names or aliases; "up" and "down" use the current component, if no name is given.
+
+// Returns 1, if the argument starts a selection form (other than a list of names).
+int is_selection_keyword(const char* arg);
+
+// Returns the selected components in the build order, as a list, which should be freed with list_free(list, NULL).
+// Sets 'skip_disabled' to 1 for unrestricted forms ('all', 'up' and 'down' without -t), which should skip disabled
+// components, and to 0 otherwise. Calls die() on errors.
+struct list* select_components(struct ag_project* project, int argc, const char** argv, int* skip_disabled);
+
+#endif /* SELECTION_H */
@@ -0,0 +1,119 @@
+// for memfd_create() and posix_spawn_file_actions_addchdir_np()
+#define _GNU_SOURCE
+
+#include "spawn.h"
+#include "common.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__GLIBC__) && (2 < __GLIBC__ || (2 == __GLIBC__ && 29 <= __GLIBC_MINOR__))
+#define HAVE_SPAWN_CHDIR 1
+#endif
+
+#ifdef HAVE_SPAWN_CHDIR
+#include <spawn.h>
+#include <sys/mman.h>
+
+extern char** environ;
+
+static int write_all(int fd, const char* data, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, data, len);
+        if (0 > n) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Creates an in-memory file with the script. Returns its descriptor, or -1, if memfd isn't supported.
+static int script_memfd(const char* script) {
+    // not close-on-exec, as the shell reads the script via /dev/fd; the parent closes it right after spawning
+    int fd = memfd_create("agnostic-script", 0);
+    if (0 <= fd && write_all(fd, script, strlen(script))) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+static pid_t spawn_sh(const char* dir, const char* script_path, int output_fd, int new_group) {
+    posix_spawn_file_actions_t actions;
+    if (posix_spawn_file_actions_init(&actions)) {
+        return -1;
+    }
+    if (dir) {
+        posix_spawn_file_actions_addchdir_np(&actions, dir);
+    }
+    if (-1 != output_fd) {
+        posix_spawn_file_actions_adddup2(&actions, output_fd, STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, output_fd, STDERR_FILENO);
+        if (STDOUT_FILENO != output_fd && STDERR_FILENO != output_fd) {
+            posix_spawn_file_actions_addclose(&actions, output_fd);
+        }
+    }
+    posix_spawnattr_t attr;
+    if (posix_spawnattr_init(&attr)) {
+        posix_spawn_file_actions_destroy(&actions);
+        return -1;
+    }
+    if (new_group) {
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+        posix_spawnattr_setpgroup(&attr, 0);
+    }
+    pid_t pid = -1;
+    char* const argv[] = { "sh", "-xe", (char*)script_path, NULL };
+    int rc = posix_spawn(&pid, "/bin/sh", &actions, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    if (rc) {
+        errno = rc;
+        return -1;
+    }
+    return pid;
+}
+
+pid_t spawn_script(const char* dir, const char* script, int output_fd, int new_group, char** script_file) {
+    assert(script);
+    assert(script_file);
+
+    *script_file = NULL;
+    int fd = script_memfd(script);
+    if (0 > fd) {
+        *script_file = create_temp_file("agnostic-script-", script);
+        if (!*script_file) {
+            return -1;
+        }
+        return spawn_sh(dir, *script_file, output_fd, new_group);
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "/dev/fd/%d", fd);
+    pid_t pid = spawn_sh(dir, path, output_fd, new_group);
+    close(fd);
+    return pid;
+}
+
+#else
+
+pid_t spawn_script(const char* dir, const char* script, int output_fd, int new_group, char** script_file) {
+    assert(script);
+    assert(script_file);
+
+    *script_file = create_temp_file("agnostic-script-", script);
+    if (!*script_file) {
+        return -1;
+    }
+    return run_script(dir, *script_file, output_fd, NULL, new_group);
+}
+
+#endif
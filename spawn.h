@@ -0,0 +1,14 @@
+#ifndef SPAWN_H
+#define SPAWN_H
+
+#include <sys/types.h>
+
+// Runs the script from the given directory, like run_script(), but without writing it to a file and without copying
+// the parent's address space: the script is passed to the shell through an in-memory file (memfd), and the shell is
+// started with posix_spawn(), which uses vfork() semantics. Where that's unsupported, falls back to a temp file and
+// run_script(). Returns child process PID, or -1 on failure. If a temp file was created, its name is stored in
+// 'script_file', and it should be removed after the script finishes; otherwise 'script_file' is set to NULL.
+// If new_group is 1, the script runs in its own process group.
+pid_t spawn_script(const char* dir, const char* script, int output_fd, int new_group, char** script_file);
+
+#endif /* SPAWN_H */
@@ -0,0 +1,226 @@
+// for asprintf()
+#define _GNU_SOURCE
+
+#include "stamp.h"
+#include "digest.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Commands, which describe the state of a working copy. All of them are run in the component directory.
+struct vcs_commands {
+    const char* revision;   // prints the current revision
+    const char* changes;    // prints uncommitted changes to tracked files
+    const char* untracked;  // prints untracked, not ignored files, separated with '\0'
+    const char* root;       // prints the directory untracked files are relative to, or NULL for the component dir
+    const char* verify_fmt; // fails, unless the revision (%s) exists
+    const char* since_fmt;  // prints files changed since the revision (%s), including uncommitted and untracked
+    const char* modified;   // prints uncommitted and untracked files
+};
+
+static const struct vcs_commands git_commands = {
+    "git rev-parse HEAD",
+    "git diff HEAD --binary -- .",
+    "git ls-files --others --exclude-standard -z -- .",
+    NULL,
+    "git rev-parse -q --verify %s^{commit}",
+    "git diff --name-only %s -- . && git ls-files --others --exclude-standard -- .",
+    "git status --porcelain --untracked-files=all -- ."
+};
+
+static const struct vcs_commands hg_commands = {
+    "hg log -r . -T '{node}'",
+    "hg diff --git .",
+    "hg status --unknown --no-status --print0 .",
+    "hg root",
+    "hg log -r %s -T x",
+    "hg status --rev %s .",
+    "hg status ."
+};
+
+static void trim(struct buffer* b) {
+    while (b->len && ('\n' == b->data[b->len - 1] || '\r' == b->data[b->len - 1])) {
+        b->data[--b->len] = '\0';
+    }
+}
+
+// Adds names and contents of untracked files to the digest.
+static void digest_untracked(struct digest* d, const char* root, struct buffer* list) {
+    for (size_t i = 0; i < list->len; i += strlen(list->data + i) + 1) {
+        const char* name = list->data + i;
+        char* path = NULL;
+        if (-1 == asprintf(&path, "%s/%s", root, name)) {
+            die("Out of memory, asprintf failed");
+        }
+        digest_update_str(d, name);
+        struct stat st;
+        if (!lstat(path, &st) && S_ISLNK(st.st_mode)) {
+            char target[4096];
+            ssize_t n = readlink(path, target, sizeof(target) - 1);
+            target[0 < n ? n : 0] = '\0';
+            digest_update_str(d, target);
+        } else {
+            digest_update_file(d, path);
+        }
+        free(path);
+    }
+}
+
+char* stamp_source_state(struct ag_project* project, struct ag_component* c) {
+    assert(project);
+    assert(c);
+
+    const struct vcs_commands* vcs = c->hg ? &hg_commands : &git_commands;
+    char* dir = ag_component_dir(project, c);
+    char* ret = NULL;
+
+    struct buffer revision = { 0 };
+    struct buffer changes = { 0 };
+    struct buffer untracked = { 0 };
+    struct buffer root = { 0 };
+    if (!run_cmd_capture(dir, vcs->revision, &revision) && revision.len
+            && !run_cmd_capture(dir, vcs->changes, &changes)
+            && !run_cmd_capture(dir, vcs->untracked, &untracked)
+            && (!vcs->root || !run_cmd_capture(dir, vcs->root, &root))) {
+        trim(&revision);
+        trim(&root);
+
+        struct digest d;
+        digest_init(&d);
+        if (changes.len) {
+            digest_update(&d, changes.data, changes.len);
+        }
+        digest_untracked(&d, vcs->root ? root.data : dir, &untracked);
+        char hex[DIGEST_HEX_SIZE];
+        digest_final_hex(&d, hex);
+
+        if (-1 == asprintf(&ret, "revision %s\nchanges %s\n", revision.data, hex)) {
+            die("Out of memory, asprintf failed");
+        }
+    }
+    buffer_free(&revision);
+    buffer_free(&changes);
+    buffer_free(&untracked);
+    buffer_free(&root);
+    free(dir);
+    return ret;
+}
+
+// Formats the command with the quoted revision. The returned string should be freed.
+static char* format_rev_cmd(const char* fmt, const char* rev) {
+    char* quoted = shell_quote(rev);
+    char* ret = NULL;
+    if (-1 == asprintf(&ret, fmt, quoted)) {
+        die("Out of memory, asprintf failed");
+    }
+    free(quoted);
+    return ret;
+}
+
+int stamp_source_changed(struct ag_project* project, struct ag_component* c, const char* since) {
+    assert(project);
+    assert(c);
+
+    const struct vcs_commands* vcs = c->hg ? &hg_commands : &git_commands;
+    char* dir = ag_component_dir(project, c);
+    int ret = -1;
+    struct buffer out = { 0 };
+    if (!since) {
+        if (!run_cmd_capture(dir, vcs->modified, &out)) {
+            ret = 0 < out.len;
+        }
+    } else {
+        char* verify = format_rev_cmd(vcs->verify_fmt, since);
+        char* changed = format_rev_cmd(vcs->since_fmt, since);
+        if (!run_cmd_capture(dir, verify, &out)) {
+            out.len = 0;
+            if (!run_cmd_capture(dir, changed, &out)) {
+                ret = 0 < out.len;
+            }
+        }
+        free(verify);
+        free(changed);
+    }
+    buffer_free(&out);
+    free(dir);
+    return ret;
+}
+
+char* stamp_compute(struct ag_project* project, struct ag_component* c, const char* source_state) {
+    assert(project);
+    assert(c);
+
+    if (!source_state) {
+        return NULL;
+    }
+    struct buffer b = { 0 };
+    buffer_append(&b, source_state, strlen(source_state));
+
+    char hex[DIGEST_HEX_SIZE];
+    digest_str_hex(c->build, hex);
+    char line[256];
+    snprintf(line, sizeof(line), "script %s\n", hex);
+    buffer_append(&b, line, strlen(line));
+
+    for (struct list* l = c->build_after; l; l = l->next) {
+        struct ag_component* up = ag_find_component(project, (char*)l->data);
+        char* up_stamp = up ? stamp_read(project, up) : NULL;
+        if (!up_stamp) {
+            // can't tell, whether the upstream component has changed
+            buffer_free(&b);
+            return NULL;
+        }
+        digest_str_hex(up_stamp, hex);
+        free(up_stamp);
+        buffer_append(&b, "upstream ", 9);
+        buffer_append(&b, up->name, strlen(up->name));
+        buffer_append(&b, " ", 1);
+        buffer_append(&b, hex, strlen(hex));
+        buffer_append(&b, "\n", 1);
+    }
+    return b.data;
+}
+
+static char* stamp_file(struct ag_project* project, struct ag_component* c) {
+    char* name = NULL;
+    if (-1 == asprintf(&name, "stamps/%s", c->name)) {
+        die("Out of memory, asprintf failed");
+    }
+    char* ret = ag_state_file(project, name);
+    free(name);
+    return ret;
+}
+
+char* stamp_read(struct ag_project* project, struct ag_component* c) {
+    assert(project);
+    assert(c);
+
+    char* file_name = stamp_file(project, c);
+    char* ret = read_file(file_name);
+    free(file_name);
+    return ret;
+}
+
+int stamp_write(struct ag_project* project, struct ag_component* c, const char* stamp) {
+    assert(project);
+    assert(c);
+    assert(stamp);
+
+    char* file_name = stamp_file(project, c);
+    int ret = write_file_atomic(file_name, stamp);
+    free(file_name);
+    return ret;
+}
+
+void stamp_remove(struct ag_project* project, struct ag_component* c) {
+    assert(project);
+    assert(c);
+
+    char* file_name = stamp_file(project, c);
+    remove(file_name);
+    free(file_name);
+}
@@ -0,0 +1,39 @@
+#ifndef STAMP_H
+#define STAMP_H
+
+#include "agnostic.h"
+
+// Build stamps. A stamp is recorded after each successful build of a component, and describes everything the build
+// depended on: the component's VCS revision, a digest of its uncommitted changes, a digest of its build script and
+// digests of the stamps of the components it's built after. If a newly computed stamp equals the recorded one,
+// the component doesn't need to be rebuilt.
+//
+// Stamps are kept in the .agnostic/stamps directory of the project.
+
+// Returns a text describing the component's sources: VCS revision and a digest of uncommitted changes
+// (including untracked, not ignored files). The returned string should be freed.
+// Returns NULL, if the component is not under version control.
+char* stamp_source_state(struct ag_project* project, struct ag_component* c);
+
+// Checks, whether the component's sources have changed since the given revision (of the component's repository),
+// including uncommitted changes and untracked, not ignored files. If 'since' is NULL, only uncommitted changes
+// and untracked files are considered. Returns 1, if there are changes, 0, if there are none, and -1, if it's
+// unknown (i.e. the component is not under version control, or there's no such revision).
+int stamp_source_changed(struct ag_project* project, struct ag_component* c, const char* since);
+
+// Returns the stamp, which the component would get, if it was built now. The returned string should be freed.
+// 'source_state' is the result of stamp_source_state() for the component.
+// Returns NULL, if the component can't be stamped (i.e. it's not under version control, or some of its upstream
+// components have no stamps).
+char* stamp_compute(struct ag_project* project, struct ag_component* c, const char* source_state);
+
+// Returns the recorded stamp of the component, or NULL, if there's none. The returned string should be freed.
+char* stamp_read(struct ag_project* project, struct ag_component* c);
+
+// Records the stamp of the component. Returns 0 on success.
+int stamp_write(struct ag_project* project, struct ag_component* c, const char* stamp);
+
+// Removes the recorded stamp of the component, if any.
+void stamp_remove(struct ag_project* project, struct ag_component* c);
+
+#endif /* STAMP_H */
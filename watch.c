@@ -0,0 +1,248 @@
+// for asprintf()
+#define _GNU_SOURCE
+
+#include "watch.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB \
+    | IN_DELETE_SELF | IN_ONLYDIR)
+
+struct watch_dir {
+    int wd;
+    int id;
+    char* path;             // absolute path
+    char* rel;              // path relative to the tree root ("" for the root)
+    struct list* ignore;    // ignored paths of the tree
+};
+
+struct watch {
+    int fd;
+    struct watch_dir* dirs;
+    int count;
+    int cap;
+    int warned;
+};
+
+struct watch* watch_create() {
+    int fd = inotify_init();
+    if (0 > fd) {
+        return NULL;
+    }
+    struct watch* w = (struct watch*)xcalloc(1, sizeof(struct watch));
+    w->fd = fd;
+    return w;
+}
+
+void watch_free(struct watch* w) {
+    if (!w) {
+        return;
+    }
+    for (int i = 0; i < w->count; ++i) {
+        free(w->dirs[i].path);
+        free(w->dirs[i].rel);
+    }
+    free(w->dirs);
+    close(w->fd);
+    free(w);
+}
+
+static char* join(const char* a, const char* b) {
+    char* ret = NULL;
+    if (-1 == asprintf(&ret, "%s%s%s", a, (*a && *b) ? "/" : "", b)) {
+        die("Out of memory, asprintf failed");
+    }
+    return ret;
+}
+
+// Returns 1, if the relative path is one of the ignored paths, or is below one of them.
+static int ignored(struct list* ignore, const char* rel) {
+    for (struct list* l = ignore; l; l = l->next) {
+        const char* p = (const char*)l->data;
+        size_t len = strlen(p);
+        while (len && '/' == p[len - 1]) {
+            --len;
+        }
+        if (len && !strncmp(p, rel, len) && ('\0' == rel[len] || '/' == rel[len])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static struct watch_dir* find_dir(struct watch* w, int wd) {
+    for (int i = 0; i < w->count; ++i) {
+        if (wd == w->dirs[i].wd) {
+            return w->dirs + i;
+        }
+    }
+    return NULL;
+}
+
+static void add_dir(struct watch* w, const char* path, const char* rel, int id, struct list* ignore) {
+    int wd = inotify_add_watch(w->fd, path, WATCH_EVENTS);
+    if (0 > wd) {
+        if (ENOSPC == errno && !w->warned) {
+            w->warned = 1;
+            fprintf(stderr, WARN_COLOR "Too many directories to watch, consider increasing "
+                "/proc/sys/fs/inotify/max_user_watches" COLOR_RESET "\n");
+        }
+        return;
+    }
+    struct watch_dir* d = find_dir(w, wd);
+    if (d) {
+        // the same directory may be watched again after it has been re-created
+        free(d->path);
+        free(d->rel);
+    } else {
+        if (w->count == w->cap) {
+            w->cap = w->cap ? 2 * w->cap : 64;
+            w->dirs = (struct watch_dir*)xrealloc(w->dirs, w->cap * sizeof(struct watch_dir));
+        }
+        d = w->dirs + w->count++;
+    }
+    d->wd = wd;
+    d->id = id;
+    d->path = xstrdup(path);
+    d->rel = xstrdup(rel);
+    d->ignore = ignore;
+
+    DIR* dir = opendir(path);
+    struct dirent* e = NULL;
+    while (dir && (e = readdir(dir))) {
+        if (!strcmp(".", e->d_name) || !strcmp("..", e->d_name)) {
+            continue;
+        }
+        char* sub_rel = join(rel, e->d_name);
+        if (!ignored(ignore, sub_rel)) {
+            char* sub_path = join(path, e->d_name);
+            struct stat st;
+            if (!lstat(sub_path, &st) && S_ISDIR(st.st_mode)) {
+                add_dir(w, sub_path, sub_rel, id, ignore);
+            }
+            free(sub_path);
+        }
+        free(sub_rel);
+    }
+    if (dir) {
+        closedir(dir);
+    }
+}
+
+int watch_add_tree(struct watch* w, const char* dir, int id, struct list* ignore) {
+    assert(w);
+    assert(dir);
+
+    int count = w->count;
+    add_dir(w, dir, "", id, ignore);
+    return count == w->count ? -1 : 0;
+}
+
+// Reads available events. Returns the number of relevant events, or -1 on failure.
+static int read_events(struct watch* w, char* changed) {
+    char buf[16 * 1024] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t n = read(w->fd, buf, sizeof(buf));
+    if (0 > n) {
+        return EINTR == errno ? 0 : -1;
+    }
+    int ret = 0;
+    for (char* p = buf; p < buf + n; ) {
+        struct inotify_event* e = (struct inotify_event*)p;
+        p += sizeof(struct inotify_event) + e->len;
+        if (e->mask & IN_Q_OVERFLOW) {
+            // changes are lost, so consider everything changed
+            for (int i = 0; i < w->count; ++i) {
+                changed[w->dirs[i].id] = 1;
+            }
+            ++ret;
+            continue;
+        }
+        struct watch_dir* d = find_dir(w, e->wd);
+        if (!d || (e->mask & IN_IGNORED)) {
+            continue;
+        }
+        char* rel = join(d->rel, e->len ? e->name : "");
+        if (!ignored(d->ignore, rel)) {
+            changed[d->id] = 1;
+            ++ret;
+            if ((e->mask & (IN_CREATE | IN_MOVED_TO)) && (e->mask & IN_ISDIR)) {
+                char* path = join(d->path, e->name);
+                add_dir(w, path, rel, d->id, d->ignore);
+                free(path);
+            }
+        }
+        free(rel);
+    }
+    return ret;
+}
+
+int watch_wait(struct watch* w, char* changed, int count, int quiet_ms) {
+    assert(w);
+    assert(changed);
+
+    int pending = 0;
+    for (int i = 0; i < count; ++i) {
+        pending |= changed[i];
+    }
+    struct pollfd pfd = { w->fd, POLLIN, 0 };
+    while (1) {
+        int rc = poll(&pfd, 1, pending ? quiet_ms : -1);
+        if (0 > rc) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return -1;
+        }
+        if (0 == rc) {
+            // quiet period has passed
+            return 0;
+        }
+        int events = read_events(w, changed);
+        if (0 > events) {
+            return -1;
+        }
+        pending |= 0 < events;
+    }
+}
+
+void watch_drain(struct watch* w, char* changed) {
+    assert(w);
+    assert(changed);
+
+    struct pollfd pfd = { w->fd, POLLIN, 0 };
+    while (0 < poll(&pfd, 1, 0) && 0 <= read_events(w, changed)) {
+    }
+}
+
+#else
+
+struct watch* watch_create() {
+    return NULL;
+}
+
+void watch_free(struct watch* w) {
+}
+
+int watch_add_tree(struct watch* w, const char* dir, int id, struct list* ignore) {
+    return -1;
+}
+
+int watch_wait(struct watch* w, char* changed, int count, int quiet_ms) {
+    return -1;
+}
+
+void watch_drain(struct watch* w, char* changed) {
+}
+
+#endif
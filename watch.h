@@ -0,0 +1,28 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "common.h"
+
+// Watches directory trees for changes (Linux inotify). Each tree has an integer id, which is used to report changes.
+
+struct watch;
+
+// Creates a watch. Returns NULL, if watching is not supported.
+struct watch* watch_create();
+
+// Frees the watch.
+void watch_free(struct watch* w);
+
+// Starts watching the directory tree, including subdirectories created later. Changes of 'ignore' paths (string list
+// of paths relative to 'dir', e.g. ".git") and anything below them are ignored. Returns 0 on success.
+int watch_add_tree(struct watch* w, const char* dir, int id, struct list* ignore);
+
+// Waits for changes and sets changed[id] to 1 for each changed tree. After a change, waits until there are no more
+// changes for 'quiet_ms' milliseconds, so that bursts of changes are reported at once. If some tree is already marked
+// changed, doesn't wait for the first change. Returns 0 on success.
+int watch_wait(struct watch* w, char* changed, int count, int quiet_ms);
+
+// Collects pending changes without waiting. Sets changed[id] to 1 for each changed tree.
+void watch_drain(struct watch* w, char* changed);
+
+#endif /* WATCH_H */
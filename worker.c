@@ -0,0 +1,440 @@
+// for asprintf()
+#define _GNU_SOURCE
+
+#include "worker.h"
+#include "spawn.h"
+#include "common.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Scripts larger than this are rejected by workers.
+#define MAX_SCRIPT_SIZE (16 * 1024 * 1024)
+
+static int write_all(int fd, const char* data, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, data, len);
+        if (0 > n) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int read_full(int fd, char* data, size_t len) {
+    while (len) {
+        ssize_t n = read(fd, data, len);
+        if (0 > n && EINTR == errno) {
+            continue;
+        }
+        if (0 >= n) {
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Reads a line without the trailing '\n'. Returns 0 on success.
+static int read_line(int fd, char* line, size_t size) {
+    size_t len = 0;
+    while (len + 1 < size) {
+        if (read_full(fd, line + len, 1)) {
+            return -1;
+        }
+        if ('\n' == line[len]) {
+            line[len] = '\0';
+            return 0;
+        }
+        ++len;
+    }
+    return -1;
+}
+
+// Returns the socket path, if the address is a Unix socket address, or NULL otherwise.
+static const char* unix_path(const char* address) {
+    if (!strncmp("unix:", address, 5)) {
+        return address + 5;
+    }
+    return strchr(address, '/') ? address : NULL;
+}
+
+// Opens a listening (if 'server' is 1) or connected socket for the address. Returns the socket, or -1 on failure.
+static int open_socket(const char* address, int server) {
+    const char* path = unix_path(address);
+    if (path) {
+        struct sockaddr_un sun;
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        if (strlen(path) >= sizeof(sun.sun_path)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        strcpy(sun.sun_path, path);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (0 > fd) {
+            return -1;
+        }
+        if (server) {
+            // a socket left by a previous worker
+            unlink(path);
+        }
+        if (server ? (bind(fd, (struct sockaddr*)&sun, sizeof(sun)) || listen(fd, 64))
+                : connect(fd, (struct sockaddr*)&sun, sizeof(sun))) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    const char* colon = strrchr(address, ':');
+    if (!colon || !colon[1]) {
+        errno = EINVAL;
+        return -1;
+    }
+    char* host = xstrdup(address);
+    host[colon - address] = '\0';
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = server ? AI_PASSIVE : 0;
+    struct addrinfo* info = NULL;
+    int rc = getaddrinfo(*host ? host : NULL, colon + 1, &hints, &info);
+    free(host);
+    if (rc) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo* ai = info; ai && 0 > fd; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (0 > fd) {
+            continue;
+        }
+        int on = 1;
+        if (server ? (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on))
+                    || bind(fd, ai->ai_addr, ai->ai_addrlen) || listen(fd, 64))
+                : connect(fd, ai->ai_addr, ai->ai_addrlen)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(info);
+    return fd;
+}
+
+// Sends the output frame. Returns 0 on success.
+static int send_output(int fd, const char* data, size_t len) {
+    char header[64];
+    int n = snprintf(header, sizeof(header), "output %zu\n", len);
+    return write_all(fd, header, n) || write_all(fd, data, len);
+}
+
+// Runs the script and relays its output over the connection.
+static void run_job(int fd, const char* dir, const char* script) {
+    int fds[2];
+    if (pipe(fds)) {
+        return;
+    }
+    printf("Running script in %s\n", dir);
+    fflush(stdout);
+
+    long long started = now_ms();
+    char* script_file = NULL;
+    pid_t pid = spawn_script(dir, script, fds[1], 1, &script_file);
+    close(fds[1]);
+    if (-1 == pid) {
+        const char* msg = "Unable to run script on worker\n";
+        send_output(fd, msg, strlen(msg));
+        close(fds[0]);
+        if (script_file) {
+            remove(script_file);
+            free(script_file);
+        }
+        return;
+    }
+
+    int connected = 1;
+    char buf[16 * 1024];
+    while (1) {
+        struct pollfd pfd[2] = { { fds[0], POLLIN, 0 }, { fd, POLLIN, 0 } };
+        if (0 > poll(pfd, connected ? 2 : 1, -1)) {
+            if (EINTR == errno) {
+                continue;
+            }
+            break;
+        }
+        if (connected && pfd[1].revents) {
+            // the coordinator doesn't send anything after the job, so it's gone
+            connected = 0;
+            kill(-pid, SIGTERM);
+        }
+        if (pfd[0].revents) {
+            ssize_t n = read(fds[0], buf, sizeof(buf));
+            if (0 > n && EINTR == errno) {
+                continue;
+            }
+            if (0 >= n) {
+                break;
+            }
+            if (connected && send_output(fd, buf, n)) {
+                connected = 0;
+                kill(-pid, SIGTERM);
+            }
+        }
+    }
+    close(fds[0]);
+
+    int status = 0;
+    struct rusage ru;
+    memset(&ru, 0, sizeof(ru));
+    while (0 > wait4(pid, &status, 0, &ru) && EINTR == errno) {
+    }
+    if (script_file) {
+        remove(script_file);
+        free(script_file);
+    }
+    char line[256];
+    snprintf(line, sizeof(line), "exit %d %lld %lld %ld %lld\n", status,
+        (long long)ru.ru_utime.tv_sec * 1000000 + ru.ru_utime.tv_usec,
+        (long long)ru.ru_stime.tv_sec * 1000000 + ru.ru_stime.tv_usec,
+        ru.ru_maxrss, now_ms() - started);
+    if (connected) {
+        write_all(fd, line, strlen(line));
+    }
+    printf("Finished script in %s: %s", dir, line);
+    fflush(stdout);
+}
+
+// Serves a single job received over the connection.
+static void serve_job(int fd, int slots) {
+    char line[256];
+    snprintf(line, sizeof(line), WORKER_PROTOCOL " %d\n", slots);
+    size_t dir_len = 0;
+    size_t script_len = 0;
+    if (write_all(fd, line, strlen(line)) || read_line(fd, line, sizeof(line))
+            || 2 != sscanf(line, "run %zu %zu", &dir_len, &script_len)
+            || PATH_MAX <= dir_len || MAX_SCRIPT_SIZE < script_len) {
+        // the coordinator has only asked for the number of slots
+        return;
+    }
+    char* dir = (char*)xcalloc(dir_len + 1, 1);
+    char* script = (char*)xcalloc(script_len + 1, 1);
+    if (!read_full(fd, dir, dir_len) && !read_full(fd, script, script_len)) {
+        run_job(fd, dir, script);
+    }
+    free(script);
+    free(dir);
+}
+
+int worker_serve(const char* address, int slots) {
+    assert(address);
+    assert(0 < slots);
+
+    int server_fd = open_socket(address, 1);
+    if (0 > server_fd) {
+        perror(address);
+        return 1;
+    }
+    // the coordinator may disconnect at any time
+    signal(SIGPIPE, SIG_IGN);
+    printf("Worker is listening on %s, running up to %d scripts at a time\n", address, slots);
+    fflush(stdout);
+
+    int running = 0;
+    while (1) {
+        while (0 < waitpid(-1, NULL, WNOHANG)) {
+            --running;
+        }
+        if (running >= slots) {
+            // further connections wait in the backlog until a slot is free
+            if (0 < waitpid(-1, NULL, 0)) {
+                --running;
+            }
+            continue;
+        }
+        int fd = accept(server_fd, NULL, NULL);
+        if (0 > fd) {
+            if (EINTR == errno || ECONNABORTED == errno) {
+                continue;
+            }
+            perror("accept");
+            close(server_fd);
+            return 1;
+        }
+        pid_t pid = xfork();
+        if (0 == pid) {
+            close(server_fd);
+            serve_job(fd, slots);
+            close(fd);
+            xexit(0);
+        }
+        if (-1 == pid) {
+            perror("fork");
+        } else {
+            ++running;
+        }
+        close(fd);
+    }
+}
+
+// Connects to the worker and reads the greeting. Returns the socket, or -1 on failure. Sets '*slots', if not NULL.
+static int connect_worker(const char* address, int* slots) {
+    int fd = open_socket(address, 0);
+    if (0 > fd) {
+        return -1;
+    }
+    char line[256];
+    int n = 0;
+    if (read_line(fd, line, sizeof(line)) || strncmp(WORKER_PROTOCOL " ", line, strlen(WORKER_PROTOCOL) + 1)
+            || 1 != sscanf(line + strlen(WORKER_PROTOCOL) + 1, "%d", &n) || 1 > n) {
+        close(fd);
+        errno = EPROTO;
+        return -1;
+    }
+    if (slots) {
+        *slots = n;
+    }
+    return fd;
+}
+
+struct worker_pool* worker_pool_create(const char* addresses, char** error) {
+    assert(addresses);
+    assert(error);
+
+    struct worker_pool* pool = (struct worker_pool*)xcalloc(1, sizeof(struct worker_pool));
+    char* list = xstrdup(addresses);
+    char* save = NULL;
+    *error = NULL;
+    for (char* a = strtok_r(list, ",", &save); a; a = strtok_r(NULL, ",", &save)) {
+        int slots = 0;
+        int fd = connect_worker(a, &slots);
+        if (0 > fd) {
+            if (-1 == asprintf(error, "worker %s is not available: %s", a, strerror(errno))) {
+                die("Out of memory, asprintf failed");
+            }
+            break;
+        }
+        close(fd);
+        pool->hosts = (struct worker_host*)xrealloc(pool->hosts, (pool->count + 1) * sizeof(struct worker_host));
+        pool->hosts[pool->count].address = xstrdup(a);
+        pool->hosts[pool->count].slots = slots;
+        pool->hosts[pool->count].running = 0;
+        pool->slots += slots;
+        ++pool->count;
+    }
+    free(list);
+    if (!*error && !pool->count) {
+        *error = xstrdup("no workers given");
+    }
+    if (*error) {
+        worker_pool_free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void worker_pool_free(struct worker_pool* pool) {
+    if (!pool) {
+        return;
+    }
+    for (int i = 0; i < pool->count; ++i) {
+        free(pool->hosts[i].address);
+    }
+    free(pool->hosts);
+    free(pool);
+}
+
+struct worker_host* worker_pool_pick(struct worker_pool* pool) {
+    assert(pool);
+
+    struct worker_host* ret = NULL;
+    for (int i = 0; i < pool->count; ++i) {
+        struct worker_host* h = pool->hosts + i;
+        if (h->running < h->slots && (!ret || h->slots - h->running > ret->slots - ret->running)) {
+            ret = h;
+        }
+    }
+    return ret;
+}
+
+// Relays the job to the worker and exits with the status of the script. Runs in the proxy process.
+static void proxy(const char* address, const char* dir, const char* script, int out) {
+    int fd = connect_worker(address, NULL);
+    if (0 > fd) {
+        dprintf(out, "Unable to connect to worker %s: %s\n", address, strerror(errno));
+        xexit(255);
+    }
+    char line[256];
+    int n = snprintf(line, sizeof(line), "run %zu %zu\n", strlen(dir), strlen(script));
+    if (write_all(fd, line, n) || write_all(fd, dir, strlen(dir)) || write_all(fd, script, strlen(script))) {
+        dprintf(out, "Unable to send job to worker %s: %s\n", address, strerror(errno));
+        xexit(255);
+    }
+
+    char buf[16 * 1024];
+    while (!read_line(fd, line, sizeof(line))) {
+        size_t len = 0;
+        int status = 0;
+        long long user = 0;
+        long long sys = 0;
+        long rss = 0;
+        long long wall = 0;
+        if (1 == sscanf(line, "output %zu", &len)) {
+            while (len) {
+                size_t chunk = len < sizeof(buf) ? len : sizeof(buf);
+                if (read_full(fd, buf, chunk)) {
+                    break;
+                }
+                write_all(out, buf, chunk);
+                len -= chunk;
+            }
+        } else if (5 == sscanf(line, "exit %d %lld %lld %ld %lld", &status, &user, &sys, &rss, &wall)) {
+            dprintf(out, "Worker %s: %.2fs, CPU %.2fs user, %.2fs system, max RSS %.1f MiB\n", address,
+                wall / 1000.0, user / 1e6, sys / 1e6, rss / 1024.0);
+            close(fd);
+            if (WIFSIGNALED(status)) {
+                signal(WTERMSIG(status), SIG_DFL);
+                kill(getpid(), WTERMSIG(status));
+                xexit(128 + WTERMSIG(status));
+            }
+            xexit(WIFEXITED(status) ? WEXITSTATUS(status) : 255);
+        } else {
+            break;
+        }
+    }
+    dprintf(out, "Lost connection to worker %s\n", address);
+    xexit(255);
+}
+
+pid_t worker_run(struct worker_host* host, const char* dir, const char* script, int output_fd) {
+    assert(host);
+    assert(dir);
+    assert(script);
+
+    pid_t pid = xfork();
+    if (0 == pid) {
+        signal(SIGPIPE, SIG_IGN);
+        proxy(host->address, dir, script, -1 != output_fd ? output_fd : STDOUT_FILENO);
+    }
+    return pid;
+}
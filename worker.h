@@ -0,0 +1,53 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <sys/types.h>
+
+// Remote execution of component scripts.
+//
+// A worker ('ag worker') listens on a TCP address ("host:port") or a Unix socket (a path, or "unix:<path>"), and
+// runs scripts it's sent, in the given directory, which should be shared with the coordinator (e.g. the same
+// workspace, mounted at the same path). Each connection carries a single job. The protocol is:
+//
+//   worker:      "AGWORKER 1 <slots>\n"
+//   coordinator: "run <directory length> <script length>\n" <directory> <script>
+//   worker:      "output <length>\n" <bytes>   (any number of times, as the script writes its output)
+//   worker:      "exit <wait status> <user usec> <system usec> <max RSS KiB> <wall msec>\n"
+//
+// A worker runs up to <slots> jobs at a time; more connections wait. If the coordinator disconnects, the script is
+// killed.
+
+#define WORKER_PROTOCOL "AGWORKER 1"
+
+struct worker_host {
+    char* address;
+    int slots;      // number of scripts the worker runs concurrently
+    int running;    // number of scripts currently sent to the worker
+};
+
+struct worker_pool {
+    struct worker_host* hosts;
+    int count;
+    int slots;      // total slots of all workers
+};
+
+// Serves jobs on the given address, running up to 'slots' scripts concurrently. Returns only on failure,
+// with non-zero value.
+int worker_serve(const char* address, int slots);
+
+// Connects to all workers from the comma-separated list of addresses, and asks them for their number of slots.
+// Returns NULL and sets 'error', if some worker is unavailable.
+struct worker_pool* worker_pool_create(const char* addresses, char** error);
+
+// Frees the pool.
+void worker_pool_free(struct worker_pool* pool);
+
+// Returns the least loaded worker, which has a free slot, or NULL, if there's none.
+struct worker_host* worker_pool_pick(struct worker_pool* pool);
+
+// Runs the script in the given directory on the worker. Returns PID of a local proxy process, which relays output
+// of the script to 'output_fd' (or stdout, if it's -1), reports resource usage of the script, and exits with the
+// same status as the script. Returns -1 on failure.
+pid_t worker_run(struct worker_host* host, const char* dir, const char* script, int output_fd);
+
+#endif /* WORKER_H */